@@ -0,0 +1,126 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                           License Agreement
+//
+// Copyright (C) 2014 Takuya MINAGAWA.
+// Third party copyrights are property of their respective owners.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//M*/
+
+/******************************************************************************
+AnnotationConverter <input file> <output file> [score file]
+
+Convert an annotation file between the text format and the binary columnar format.
+The direction is decided by the input file.
+
+text -> binary: [score file] is stored in the binary file with the rectangles.
+binary -> text: scores in the binary file are saved into [score file].
+*******************************************************************************/
+
+#include <iostream>
+#include "Util.h"
+
+
+int TextToBinary(const std::string& input_file, const std::string& output_file, const std::string& score_file)
+{
+	util::AnnotationList annotations;
+	if (!util::LoadAnnotationFile(input_file, annotations)){
+		std::cerr << "Fail to load " << input_file << std::endl;
+		return -1;
+	}
+
+	util::ScoreList scores;
+	if (!score_file.empty() && !util::LoadScoreFile(score_file, scores)){
+		std::cerr << "Fail to load " << score_file << std::endl;
+		return -1;
+	}
+
+	if (!util::SaveBinaryAnnotationFile(output_file, annotations, score_file.empty() ? 0 : &scores)){
+		std::cerr << "Error: Fail to save " << output_file << std::endl;
+		return -1;
+	}
+	std::cout << "Save binary annotation file in " << output_file << std::endl;
+	return 0;
+}
+
+
+int BinaryToText(const std::string& input_file, const std::string& output_file, const std::string& score_file)
+{
+	util::AnnotationList annotations;
+	if (!util::LoadAnnotationFile(input_file, annotations)){
+		std::cerr << "Fail to load " << input_file << std::endl;
+		return -1;
+	}
+	// class ids are written back after each rectangle
+	util::FlatList<cv::Rect> positions;
+	util::FlatList<int> labels;
+	positions.data.swap(annotations.rects);
+	positions.offsets.swap(annotations.offsets);
+	if (annotations.has_labels()){
+		labels.data.swap(annotations.labels);
+		labels.offsets = positions.offsets;
+	}
+	if (!util::SaveAnnotationFile(output_file, annotations.imgpathlist, positions, labels)){
+		std::cerr << "Error: Fail to save " << output_file << std::endl;
+		return -1;
+	}
+	std::cout << "Save annotation file in " << output_file << std::endl;
+
+	if (!score_file.empty()){
+		std::vector<std::vector<float>> scores;
+		if (!util::LoadScoreFile(input_file, scores)){
+			std::cerr << "Fail to load scores in " << input_file << std::endl;
+			return -1;
+		}
+		if (!util::SaveScoreFile(score_file, scores)){
+			std::cerr << "Error: Fail to save " << score_file << std::endl;
+			return -1;
+		}
+		std::cout << "Save score file in " << score_file << std::endl;
+	}
+	return 0;
+}
+
+
+int main(int argc, char * argv[])
+{
+	if (argc < 3){
+		std::cout << argv[0] << " <input file> <output file> [score file]" << std::endl;
+		return -1;
+	}
+
+	std::string input_file = argv[1];
+	std::string output_file = argv[2];
+	std::string score_file;
+	if (argc > 3)
+		score_file = argv[3];
+
+	if (util::IsBinaryAnnotationFile(input_file))
+		return BinaryToText(input_file, output_file, score_file);
+	else
+		return TextToBinary(input_file, output_file, score_file);
+}
@@ -0,0 +1,429 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                           License Agreement
+//
+// Copyright (C) 2014 Takuya MINAGAWA.
+// Third party copyrights are property of their respective owners.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//M*/
+
+/******************************************************************************
+Benchmark [option]
+
+Benchmarks of the eval:: and util:: routines on synthetic data sets.
+Results are written to standard output as CSV: routine,size,milliseconds
+(size is the number of detections for pipeline stages).
+
+pipeline:   every stage of EvalLocalization on a generated data set:
+            save, LoadAnnotationFile, LoadScoreFile (nested, and flat on '-j' threads), bindRectPairs,
+            EvaluateDetection, RecallPrecision, AveragePrecision, SaveSummary,
+            SaveAnnotationFile (nested, and flat on '-j' threads) and SaveRecallPrecisionCurve (on '-j' threads)
+assignment: eval::HangarianAlgorithm vs eval::KuhnMunkres on crowd-scene sized
+            cost matrices (1 - overlap of detections and ground truth)
+overlap:    eval::calcRectOverlap per pair vs eval::calcRectOverlaps per detection
+            on dense scenes (all detections x all ground truth of a frame)
+
+The data set is generated with a fixed seed, so runs are comparable.
+'--keep <dir>' leaves the generated files in <dir> for use with EvalLocalization.
+*******************************************************************************/
+
+#include <opencv2/core/core.hpp>
+#include <boost/program_options.hpp>
+#include <boost/filesystem.hpp>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <cstdlib>
+#include <cmath>
+#include "EvalFunctions.h"
+#include "Util.h"
+
+using namespace boost::program_options;
+
+
+//! Parameters of a synthetic data set
+struct SyntheticOption{
+	int image_num;
+	double boxes;			// mean number of ground truth per image
+	double density;			// total area of ground truth / area of a frame
+	std::string score_dist;	// beta, uniform or discrete
+	unsigned int seed;
+};
+
+
+// beta(a, b) distributed value from two gamma distributions
+float SampleBeta(std::mt19937& rng, double a, double b)
+{
+	std::gamma_distribution<double> gamma_a(a, 1.0), gamma_b(b, 1.0);
+	double x = gamma_a(rng);
+	double y = gamma_b(rng);
+	return (float)(x / (x + y));
+}
+
+
+// score of a detection: with "beta", detections close to ground truth get higher scores
+float SampleScore(std::mt19937& rng, const std::string& score_dist, bool near_ground_truth)
+{
+	std::uniform_real_distribution<float> uniform(0, 1);
+	if (score_dist == "uniform")
+		return uniform(rng);
+	if (score_dist == "discrete")	// many ties
+		return std::floor(uniform(rng) * 20) / 20;
+	return near_ground_truth ? SampleBeta(rng, 5, 2) : SampleBeta(rng, 2, 5);
+}
+
+
+// Ground truth of 20-100 pixels scattered over a square frame sized by the density.
+// 80% of ground truth is detected with a jitter and there are false positives half
+// as many as ground truth on average.
+void MakeSyntheticDataset(const SyntheticOption& option, std::vector<std::string>& img_files,
+	std::vector<std::vector<cv::Rect>>& detect_positions, std::vector<std::vector<cv::Rect>>& ground_truth,
+	std::vector<std::vector<float>>& scores)
+{
+	std::mt19937 rng(option.seed);
+	const int min_size = 20, max_size = 100;
+	double mean_area = (min_size + max_size) * (min_size + max_size) / 4.0;
+	int frame = (int)std::sqrt(std::max(option.boxes, 1.0) * mean_area / std::max(option.density, 1e-6)) + max_size;
+
+	std::poisson_distribution<int> gt_num(option.boxes), fp_num(option.boxes * 0.5);
+	std::uniform_int_distribution<int> pos(0, frame - max_size), size(min_size, max_size);
+	std::uniform_real_distribution<float> uniform(0, 1);
+	std::normal_distribution<float> jitter(0, 0.1f);
+
+	img_files.resize(option.image_num);
+	detect_positions.assign(option.image_num, std::vector<cv::Rect>());
+	ground_truth.assign(option.image_num, std::vector<cv::Rect>());
+	scores.assign(option.image_num, std::vector<float>());
+	for (int n = 0; n < option.image_num; n++){
+		std::stringstream str;
+		str << "images/" << n << ".jpg";
+		img_files[n] = str.str();
+
+		int G = gt_num(rng);
+		for (int g = 0; g < G; g++){
+			cv::Rect gt(pos(rng), pos(rng), size(rng), size(rng));
+			ground_truth[n].push_back(gt);
+			if (uniform(rng) < 0.8f){
+				cv::Rect det(gt.x + (int)(gt.width * jitter(rng)), gt.y + (int)(gt.height * jitter(rng)),
+					std::max(1, (int)(gt.width * (1 + jitter(rng)))), std::max(1, (int)(gt.height * (1 + jitter(rng)))));
+				detect_positions[n].push_back(det);
+				scores[n].push_back(SampleScore(rng, option.score_dist, true));
+			}
+		}
+		int F = fp_num(rng);
+		for (int f = 0; f < F; f++){
+			detect_positions[n].push_back(cv::Rect(pos(rng), pos(rng), size(rng), size(rng)));
+			scores[n].push_back(SampleScore(rng, option.score_dist, false));
+		}
+	}
+}
+
+
+// keep messages of the save functions out of the CSV on standard output
+class MuteStdout{
+public:
+	MuteStdout() : buf_(std::cout.rdbuf(null_.rdbuf())){}
+	~MuteStdout(){ std::cout.rdbuf(buf_); }
+
+private:
+	std::stringstream null_;
+	std::streambuf* buf_;
+};
+
+
+// crowd scene: boxes scattered over a 1920x1080 frame, detections jittered around ground truth
+void MakeCrowdScene(int num, std::mt19937& rng,
+	std::vector<cv::Rect>& detect_positions, std::vector<cv::Rect>& ground_truth)
+{
+	std::uniform_int_distribution<int> pos_x(0, 1840), pos_y(0, 1000), size(20, 80), jitter(-8, 8);
+	ground_truth.clear();
+	detect_positions.clear();
+	for (int i = 0; i < num; i++){
+		cv::Rect gt(pos_x(rng), pos_y(rng), size(rng), size(rng));
+		ground_truth.push_back(gt);
+		detect_positions.push_back(cv::Rect(gt.x + jitter(rng), gt.y + jitter(rng), gt.width + jitter(rng), gt.height + jitter(rng)));
+	}
+}
+
+
+double ElapsedMilliseconds(const std::chrono::high_resolution_clock::time_point& start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+
+void BenchmarkAssignment(int repeat)
+{
+	const int sizes[] = { 50, 100, 200, 300, 500 };
+	std::mt19937 rng(0);
+
+	for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		int N = sizes[s];
+		std::vector<cv::Rect> detect_positions, ground_truth;
+		MakeCrowdScene(N, rng, detect_positions, ground_truth);
+
+		std::vector<float> cost(N * N);
+		for (int r = 0; r < N; r++){
+			for (int c = 0; c < N; c++){
+				cost[r * N + c] = 1 - eval::calcRectOverlap(detect_positions[c], ground_truth[r]);
+			}
+		}
+
+		double hangarian_ms = 0, kuhn_munkres_ms = 0;
+		for (int i = 0; i < repeat; i++){
+			// HangarianAlgorithm() modifies the matrix it is given
+			cv::Mat_<float> cost_mat(N, N);
+			for (int r = 0; r < N; r++){
+				for (int c = 0; c < N; c++){
+					cost_mat(r, c) = cost[r * N + c];
+				}
+			}
+			std::vector<int> permutation;
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			eval::HangarianAlgorithm(cost_mat, permutation);
+			hangarian_ms += ElapsedMilliseconds(start);
+
+			std::vector<int> assignment;
+			start = std::chrono::high_resolution_clock::now();
+			eval::KuhnMunkres(&cost[0], N, N, assignment);
+			kuhn_munkres_ms += ElapsedMilliseconds(start);
+		}
+		std::cout << "HangarianAlgorithm," << N << "," << hangarian_ms / repeat << std::endl;
+		std::cout << "KuhnMunkres," << N << "," << kuhn_munkres_ms / repeat << std::endl;
+	}
+}
+
+
+void BenchmarkOverlap(int repeat)
+{
+	const int sizes[] = { 100, 300, 1000, 3000 };
+	std::mt19937 rng(1);
+
+	for (int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++){
+		int N = sizes[s];
+		std::vector<cv::Rect> detect_positions, ground_truth;
+		MakeCrowdScene(N, rng, detect_positions, ground_truth);
+
+		std::vector<float> scalar_overlaps(N * N), batch_overlaps(N * N);
+		double scalar_ms = 0, batch_ms = 0;
+		for (int i = 0; i < repeat; i++){
+			std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+			for (int d = 0; d < N; d++){
+				for (int g = 0; g < N; g++){
+					scalar_overlaps[d * N + g] = eval::calcRectOverlap(detect_positions[d], ground_truth[g]);
+				}
+			}
+			scalar_ms += ElapsedMilliseconds(start);
+
+			start = std::chrono::high_resolution_clock::now();
+			eval::RectArray gt_array;
+			gt_array.assign(ground_truth);
+			for (int d = 0; d < N; d++){
+				eval::calcRectOverlaps(detect_positions[d], gt_array, &batch_overlaps[d * N]);
+			}
+			batch_ms += ElapsedMilliseconds(start);
+		}
+		if (scalar_overlaps != batch_overlaps)
+			std::cerr << "Error: calcRectOverlaps() differs from calcRectOverlap() at size " << N << std::endl;
+
+		std::cout << "calcRectOverlap," << N << "," << scalar_ms / repeat << std::endl;
+		std::cout << "calcRectOverlaps," << N << "," << batch_ms / repeat << std::endl;
+	}
+}
+
+
+// time func() averaged over repeat runs and print it as a CSV line
+template <typename Func>
+void TimeStage(const std::string& routine, int size, int repeat, const Func& func)
+{
+	double total_ms = 0;
+	for (int i = 0; i < repeat; i++){
+		std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+		func();
+		total_ms += ElapsedMilliseconds(start);
+	}
+	std::cout << routine << "," << size << "," << total_ms / repeat << std::endl;
+}
+
+
+bool BenchmarkPipeline(const SyntheticOption& option, const std::string& keep_dir, int repeat)
+{
+	using namespace boost::filesystem;
+
+	std::vector<std::string> img_files;
+	std::vector<std::vector<cv::Rect>> detect_positions, ground_truth;
+	std::vector<std::vector<float>> scores;
+	MakeSyntheticDataset(option, img_files, detect_positions, ground_truth, scores);
+	int size = util::CountVectorElements(detect_positions);
+
+	path dir_path = keep_dir.empty() ? temp_directory_path() / unique_path("evalbench-%%%%-%%%%-%%%%") : path(keep_dir);
+	create_directories(dir_path);
+	std::string local_file = (dir_path / "localization.txt").generic_string();
+	std::string gt_file = (dir_path / "ground_truth.txt").generic_string();
+	std::string score_file = (dir_path / "score.txt").generic_string();
+	std::string output_file = (dir_path / "output.txt").generic_string();
+
+	bool ret = true;
+	TimeStage("SaveAnnotationFile(localization)", size, repeat, [&](){
+		ret = util::SaveAnnotationFile(local_file, img_files, detect_positions) && ret;
+	});
+	TimeStage("SaveScoreFile", size, repeat, [&](){
+		ret = util::SaveScoreFile(score_file, scores) && ret;
+	});
+	ret = util::SaveAnnotationFile(gt_file, img_files, ground_truth) && ret;
+	if (!ret){
+		std::cerr << "Error: Fail to save the data set in " << dir_path.generic_string() << std::endl;
+		return false;
+	}
+
+	TimeStage("LoadAnnotationFile", size, repeat, [&](){
+		img_files.clear();
+		detect_positions.clear();
+		util::LoadAnnotationFile(local_file, img_files, detect_positions);
+	});
+	TimeStage("LoadScoreFile", size, repeat, [&](){
+		scores.clear();
+		util::LoadScoreFile(score_file, scores);
+	});
+	TimeStage("LoadAnnotationFile(flat)", size, repeat, [&](){
+		util::AnnotationList annotations;
+		util::LoadAnnotationFile(local_file, annotations, eval::GetNumThreads());
+	});
+	TimeStage("LoadScoreFile(flat)", size, repeat, [&](){
+		util::ScoreList score_list;
+		util::LoadScoreFile(score_file, score_list, eval::GetNumThreads());
+	});
+
+	std::vector<std::vector<int>> binded_index;
+	std::vector<std::vector<float>> overlap_score;
+	int ground_truth_num;
+	TimeStage("bindRectPairs", size, repeat, [&](){
+		eval::bindRectPairs(detect_positions, ground_truth, scores, binded_index, overlap_score, &ground_truth_num);
+	});
+
+	std::vector<std::vector<int>> true_positive_id, false_positive_id;
+	TimeStage("EvaluateDetection", size, repeat, [&](){
+		eval::EvaluateDetection(binded_index, scores, overlap_score, true_positive_id, false_positive_id, 0.5);
+	});
+
+	std::vector<float> recall, precision, thresholds;
+	TimeStage("RecallPrecision", size, repeat, [&](){
+		recall.clear();
+		precision.clear();
+		thresholds.clear();
+		eval::RecallPrecision(binded_index, scores, overlap_score, ground_truth_num, recall, precision, thresholds);
+	});
+	TimeStage("AveragePrecision", recall.size(), repeat, [&](){
+		eval::AveragePrecision(precision, recall);
+	});
+
+	std::vector<std::vector<cv::Rect>> true_positives, false_positives;
+	eval::Id2Positions(detect_positions, true_positive_id, true_positives);
+	eval::Id2Positions(detect_positions, false_positive_id, false_positives);
+	TimeStage("SaveSummary", size, repeat, [&](){
+		MuteStdout mute;
+		util::SaveSummary(output_file, img_files, ground_truth, true_positives, false_positives);
+	});
+	TimeStage("SaveAnnotationFile(true positive)", size, repeat, [&](){
+		MuteStdout mute;
+		util::SaveAnnotationFile(output_file, img_files, true_positives);
+	});
+	util::FlatList<cv::Rect> flat_true_positives;
+	flat_true_positives.assign(true_positives);
+	TimeStage("SaveAnnotationFile(flat)", size, repeat, [&](){
+		util::SaveAnnotationFile(output_file, img_files, flat_true_positives, " ", eval::GetNumThreads());
+	});
+	TimeStage("SaveRecallPrecisionCurve", recall.size(), repeat, [&](){
+		MuteStdout mute;
+		util::SaveRecallPrecisionCurve(output_file, recall, precision, thresholds, eval::GetNumThreads());
+	});
+
+	if (keep_dir.empty())
+		remove_all(dir_path);
+	else
+		remove(output_file);
+	return true;
+}
+
+
+int main(int argc, char * argv[])
+{
+	options_description opt("option");
+	opt.add_options()
+		("help,h", "Print help")
+		("suite", value<std::string>()->default_value("all"), "pipeline, assignment, overlap or all")
+		("repeat", value<int>()->default_value(3), "number of runs to average")
+		("images", value<int>()->default_value(10000), "number of images of the data set")
+		("boxes", value<double>()->default_value(10), "mean number of ground truth per image")
+		("density", value<double>()->default_value(0.1), "total area of ground truth / frame area (higher overlaps more)")
+		("scores", value<std::string>()->default_value("beta"), "score distribution: beta, uniform or discrete")
+		("seed", value<unsigned int>()->default_value(0), "random seed of the data set")
+		("jobs,j", value<int>()->default_value(1), "number of threads to parse, match images and write files (0: all cores)")
+		("keep", value<std::string>(), "directory to keep the generated data set in");
+
+	variables_map argmap;
+	try{
+		store(parse_command_line(argc, argv, opt), argmap);
+		notify(argmap);
+	}
+	catch (std::exception& e){
+		std::cout << std::endl << e.what() << std::endl;
+		std::cout << opt << std::endl;
+		return -1;
+	}
+	if (argmap.count("help")){
+		std::cout << argv[0] << " [option]" << std::endl;
+		std::cout << opt << std::endl;
+		return 0;
+	}
+
+	std::string suite = argmap["suite"].as<std::string>();
+	int repeat = std::max(1, argmap["repeat"].as<int>());
+	SyntheticOption option;
+	option.image_num = argmap["images"].as<int>();
+	option.boxes = argmap["boxes"].as<double>();
+	option.density = argmap["density"].as<double>();
+	option.score_dist = argmap["scores"].as<std::string>();
+	option.seed = argmap["seed"].as<unsigned int>();
+	std::string keep_dir;
+	if (!argmap["keep"].empty())
+		keep_dir = argmap["keep"].as<std::string>();
+	eval::SetNumThreads(argmap["jobs"].as<int>());
+
+	std::cout << "routine,size,milliseconds" << std::endl;
+	if (suite == "all" || suite == "pipeline"){
+		if (!BenchmarkPipeline(option, keep_dir, repeat))
+			return -1;
+	}
+	if (suite == "all" || suite == "assignment")
+		BenchmarkAssignment(repeat);
+	if (suite == "all" || suite == "overlap")
+		BenchmarkOverlap(repeat);
+
+	return 0;
+}
@@ -33,12 +33,52 @@
 
 #include "EvalFunctions.h"
 #include "argsort.hpp"
+#include "parallel.hpp"
+#include "Profiler.h"
 #include "Util.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <random>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define EVAL_OVERLAP_AVX2
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EVAL_OVERLAP_SSE2
+#endif
 
 using namespace std;
 
 namespace eval{
 
+	static int num_threads_ = 1;
+
+	void SetNumThreads(int num_threads)
+	{
+		num_threads_ = num_threads;
+	}
+
+
+	int GetNumThreads()
+	{
+		return num_threads_;
+	}
+
+
+	static AveragePrecisionMode ap_mode_ = AP_11_POINT;
+
+	void SetAveragePrecisionMode(AveragePrecisionMode mode)
+	{
+		ap_mode_ = mode;
+	}
+
+
+	AveragePrecisionMode GetAveragePrecisionMode()
+	{
+		return ap_mode_;
+	}
 
 	//! Q̋`̃I[o[bv̔䗦ZoBvZ@PASCAL VOCi0-1j
 	float calcRectOverlap(const cv::Rect& InputRect, const cv::Rect& CorrectRect)
@@ -95,6 +135,261 @@ namespace eval{
 	}
 
 
+	void RectArray::assign(util::Span<cv::Rect> rects)
+	{
+		int N = rects.size();
+		left.resize(N);
+		top.resize(N);
+		right.resize(N);
+		bottom.resize(N);
+		area.resize(N);
+		for (int i = 0; i < N; i++){
+			left[i] = rects[i].x;
+			top[i] = rects[i].y;
+			right[i] = rects[i].x + rects[i].width;
+			bottom[i] = rects[i].y + rects[i].height;
+			area[i] = rects[i].width * rects[i].height;
+		}
+	}
+
+
+	// Same arithmetic as calcRectOverlap(): the intersection test keeps its
+	// half-open intervals, areas are integer products and the ratio is float.
+	static inline float OverlapScalar(int l1, int t1, int r1, int b1, int area1,
+		int l2, int t2, int r2, int b2, int area2)
+	{
+		bool cross_x = (l1 >= l2 && l1 < r2) || (l2 >= l1 && l2 < r1);
+		bool cross_y = (t1 >= t2 && t1 < b2) || (t2 >= t1 && t2 < b1);
+		if (!cross_x || !cross_y)
+			return 0;
+
+		int l3 = l1 > l2 ? l1 : l2;
+		int t3 = t1 > t2 ? t1 : t2;
+		int r3 = r1 < r2 ? r1 : r2;
+		int b3 = b1 < b2 ? b1 : b2;
+		float overlap_area = (r3 - l3)*(b3 - t3);
+		float summed_area = area1 + area2;
+		return overlap_area / (summed_area - overlap_area);
+	}
+
+
+#if defined(EVAL_OVERLAP_SSE2)
+	static inline __m128i max_epi32(__m128i a, __m128i b)
+	{
+		__m128i gt = _mm_cmpgt_epi32(a, b);
+		return _mm_or_si128(_mm_and_si128(gt, a), _mm_andnot_si128(gt, b));
+	}
+
+
+	static inline __m128i min_epi32(__m128i a, __m128i b)
+	{
+		__m128i lt = _mm_cmplt_epi32(a, b);
+		return _mm_or_si128(_mm_and_si128(lt, a), _mm_andnot_si128(lt, b));
+	}
+
+
+	// lower 32 bits of the products (_mm_mullo_epi32 is SSE4.1)
+	static inline __m128i mullo_epi32(__m128i a, __m128i b)
+	{
+		__m128i even = _mm_mul_epu32(a, b);
+		__m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+		return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+			_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+	}
+
+
+	// a >= b && a < c
+	static inline __m128i in_range(__m128i a, __m128i b, __m128i c)
+	{
+		return _mm_andnot_si128(_mm_cmplt_epi32(a, b), _mm_cmplt_epi32(a, c));
+	}
+#endif
+
+
+	void calcRectOverlaps(const cv::Rect& rect, const RectArray& rects, float* overlaps)
+	{
+		int l1 = rect.x;
+		int t1 = rect.y;
+		int r1 = l1 + rect.width;
+		int b1 = t1 + rect.height;
+		int area1 = rect.width * rect.height;
+
+		int N = rects.size();
+		int i = 0;
+#if defined(EVAL_OVERLAP_AVX2)
+		__m256i vl1 = _mm256_set1_epi32(l1), vt1 = _mm256_set1_epi32(t1);
+		__m256i vr1 = _mm256_set1_epi32(r1), vb1 = _mm256_set1_epi32(b1);
+		__m256i varea1 = _mm256_set1_epi32(area1);
+		for (; i + 8 <= N; i += 8){
+			__m256i l2 = _mm256_loadu_si256((const __m256i*)&rects.left[i]);
+			__m256i t2 = _mm256_loadu_si256((const __m256i*)&rects.top[i]);
+			__m256i r2 = _mm256_loadu_si256((const __m256i*)&rects.right[i]);
+			__m256i b2 = _mm256_loadu_si256((const __m256i*)&rects.bottom[i]);
+			__m256i area2 = _mm256_loadu_si256((const __m256i*)&rects.area[i]);
+
+			// a >= b && a < c  <=>  !(b > a) && (c > a)
+			__m256i cross_x = _mm256_or_si256(
+				_mm256_andnot_si256(_mm256_cmpgt_epi32(l2, vl1), _mm256_cmpgt_epi32(r2, vl1)),
+				_mm256_andnot_si256(_mm256_cmpgt_epi32(vl1, l2), _mm256_cmpgt_epi32(vr1, l2)));
+			__m256i cross_y = _mm256_or_si256(
+				_mm256_andnot_si256(_mm256_cmpgt_epi32(t2, vt1), _mm256_cmpgt_epi32(b2, vt1)),
+				_mm256_andnot_si256(_mm256_cmpgt_epi32(vt1, t2), _mm256_cmpgt_epi32(vb1, t2)));
+			__m256i cross = _mm256_and_si256(cross_x, cross_y);
+
+			__m256i w3 = _mm256_sub_epi32(_mm256_min_epi32(vr1, r2), _mm256_max_epi32(vl1, l2));
+			__m256i h3 = _mm256_sub_epi32(_mm256_min_epi32(vb1, b2), _mm256_max_epi32(vt1, t2));
+			__m256 overlap_area = _mm256_cvtepi32_ps(_mm256_mullo_epi32(w3, h3));
+			__m256 summed_area = _mm256_cvtepi32_ps(_mm256_add_epi32(varea1, area2));
+			__m256 ratio = _mm256_div_ps(overlap_area, _mm256_sub_ps(summed_area, overlap_area));
+			_mm256_storeu_ps(overlaps + i, _mm256_and_ps(ratio, _mm256_castsi256_ps(cross)));
+		}
+#elif defined(EVAL_OVERLAP_SSE2)
+		__m128i vl1 = _mm_set1_epi32(l1), vt1 = _mm_set1_epi32(t1);
+		__m128i vr1 = _mm_set1_epi32(r1), vb1 = _mm_set1_epi32(b1);
+		__m128i varea1 = _mm_set1_epi32(area1);
+		for (; i + 4 <= N; i += 4){
+			__m128i l2 = _mm_loadu_si128((const __m128i*)&rects.left[i]);
+			__m128i t2 = _mm_loadu_si128((const __m128i*)&rects.top[i]);
+			__m128i r2 = _mm_loadu_si128((const __m128i*)&rects.right[i]);
+			__m128i b2 = _mm_loadu_si128((const __m128i*)&rects.bottom[i]);
+			__m128i area2 = _mm_loadu_si128((const __m128i*)&rects.area[i]);
+
+			__m128i cross_x = _mm_or_si128(in_range(vl1, l2, r2), in_range(l2, vl1, vr1));
+			__m128i cross_y = _mm_or_si128(in_range(vt1, t2, b2), in_range(t2, vt1, vb1));
+			__m128i cross = _mm_and_si128(cross_x, cross_y);
+
+			__m128i w3 = _mm_sub_epi32(min_epi32(vr1, r2), max_epi32(vl1, l2));
+			__m128i h3 = _mm_sub_epi32(min_epi32(vb1, b2), max_epi32(vt1, t2));
+			__m128 overlap_area = _mm_cvtepi32_ps(mullo_epi32(w3, h3));
+			__m128 summed_area = _mm_cvtepi32_ps(_mm_add_epi32(varea1, area2));
+			__m128 ratio = _mm_div_ps(overlap_area, _mm_sub_ps(summed_area, overlap_area));
+			_mm_storeu_ps(overlaps + i, _mm_and_ps(ratio, _mm_castsi128_ps(cross)));
+		}
+#endif
+		for (; i < N; i++){
+			overlaps[i] = OverlapScalar(l1, t1, r1, b1, area1,
+				rects.left[i], rects.top[i], rects.right[i], rects.bottom[i], rects.area[i]);
+		}
+	}
+
+
+	// cell of pos, clamped to [0, cell_num)
+	int RectGrid::cell_index(long long pos, long long origin, long long cell_size, int cell_num) const
+	{
+		long long c = (pos - origin) / cell_size;
+		if (pos < origin || c < 0)
+			return 0;
+		return c < cell_num ? (int)c : cell_num - 1;
+	}
+
+
+	void RectGrid::assign(util::Span<cv::Rect> rects)
+	{
+		rect_num_ = rects.size();
+		always_.clear();
+		cell_items_.clear();
+
+		// bounds and mean size of rectangles with area
+		long long right = 0, bottom = 0, total_width = 0, total_height = 0;
+		int num = 0;
+		for (int i = 0; i < rect_num_; i++){
+			const cv::Rect& r = rects[i];
+			if (r.width <= 0 || r.height <= 0){
+				always_.push_back(i);
+				continue;
+			}
+			if (num == 0){
+				left_ = r.x;
+				top_ = r.y;
+				right = (long long)r.x + r.width;
+				bottom = (long long)r.y + r.height;
+			}
+			left_ = std::min(left_, (long long)r.x);
+			top_ = std::min(top_, (long long)r.y);
+			right = std::max(right, (long long)r.x + r.width);
+			bottom = std::max(bottom, (long long)r.y + r.height);
+			total_width += r.width;
+			total_height += r.height;
+			num++;
+		}
+		if (num == 0){
+			cols_ = rows_ = 1;
+			left_ = top_ = 0;
+			cell_width_ = cell_height_ = 1;
+			cell_start_.assign(2, 0);
+			return;
+		}
+
+		// cells about the mean size, at most 2 sqrt(num) per side
+		int max_cells = (int)std::ceil(2 * std::sqrt((double)num));
+		cell_width_ = std::max(total_width / num, (right - left_ + max_cells - 1) / max_cells);
+		cell_height_ = std::max(total_height / num, (bottom - top_ + max_cells - 1) / max_cells);
+		cell_width_ = std::max(cell_width_, 1LL);
+		cell_height_ = std::max(cell_height_, 1LL);
+		cols_ = (int)((right - left_ + cell_width_ - 1) / cell_width_);
+		rows_ = (int)((bottom - top_ + cell_height_ - 1) / cell_height_);
+
+		// a rectangle covers the cells of its pixels [x, x + width - 1] x [y, y + height - 1]
+		std::vector<int> count(cols_ * rows_ + 1, 0);
+		for (int pass = 0; pass < 2; pass++){
+			for (int i = 0; i < rect_num_; i++){
+				const cv::Rect& r = rects[i];
+				if (r.width <= 0 || r.height <= 0)
+					continue;
+				int c0 = cell_index(r.x, left_, cell_width_, cols_);
+				int c1 = cell_index((long long)r.x + r.width - 1, left_, cell_width_, cols_);
+				int r0 = cell_index(r.y, top_, cell_height_, rows_);
+				int r1 = cell_index((long long)r.y + r.height - 1, top_, cell_height_, rows_);
+				for (int y = r0; y <= r1; y++){
+					for (int x = c0; x <= c1; x++){
+						if (pass == 0)
+							count[y * cols_ + x + 1]++;
+						else
+							cell_items_[count[y * cols_ + x]++] = i;
+					}
+				}
+			}
+			if (pass == 0){
+				for (int c = 0; c < cols_ * rows_; c++)
+					count[c + 1] += count[c];
+				cell_start_ = count;
+				cell_items_.resize(count[cols_ * rows_]);
+			}
+		}
+	}
+
+
+	void RectGrid::query(const cv::Rect& rect, std::vector<int>& candidates) const
+	{
+		candidates.clear();
+		if (rect.width <= 0 || rect.height <= 0){
+			for (int i = 0; i < rect_num_; i++)
+				candidates.push_back(i);
+			return;
+		}
+
+		long long right = (long long)rect.x + rect.width;
+		long long bottom = (long long)rect.y + rect.height;
+		if (right > left_ && bottom > top_ &&
+			rect.x < left_ + cols_ * cell_width_ && rect.y < top_ + rows_ * cell_height_){
+			int c0 = cell_index(rect.x, left_, cell_width_, cols_);
+			int c1 = cell_index(right - 1, left_, cell_width_, cols_);
+			int r0 = cell_index(rect.y, top_, cell_height_, rows_);
+			int r1 = cell_index(bottom - 1, top_, cell_height_, rows_);
+			for (int y = r0; y <= r1; y++){
+				for (int x = c0; x <= c1; x++){
+					int c = y * cols_ + x;
+					candidates.insert(candidates.end(), cell_items_.begin() + cell_start_[c], cell_items_.begin() + cell_start_[c + 1]);
+				}
+			}
+		}
+		candidates.insert(candidates.end(), always_.begin(), always_.end());
+
+		std::sort(candidates.begin(), candidates.end());
+		candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+	}
+
+
 	void HangarianAlgorithm(const cv::Mat_<float>& cost, std::vector<int>& permutation)
 	{
 		if (cost.cols == 1 && cost.rows == 1){
@@ -159,78 +454,298 @@ namespace eval{
 
 
 
+	float KuhnMunkres(const float* cost, int rows, int cols, std::vector<int>& assignment)
+	{
+		assignment.assign(rows, -1);
+		if (rows == 0 || cols == 0)
+			return 0;
+
+		// the solver below needs n <= m, so work on the transposed matrix otherwise
+		bool transposed = rows > cols;
+		int n = transposed ? cols : rows;
+		int m = transposed ? rows : cols;
+		std::vector<float> transposed_cost;
+		const float* a = cost;
+		if (transposed){
+			transposed_cost.resize(rows * cols);
+			for (int r = 0; r < rows; r++){
+				for (int c = 0; c < cols; c++){
+					transposed_cost[c * rows + r] = cost[r * cols + c];
+				}
+			}
+			a = &transposed_cost[0];
+		}
+
+		// potentials u (rows) and v (columns), p[j]: row bound to column j (1-origin, 0 is free)
+		const double inf = std::numeric_limits<double>::max();
+		std::vector<double> u(n + 1, 0), v(m + 1, 0), minv(m + 1);
+		std::vector<int> p(m + 1, 0), way(m + 1, 0);
+		std::vector<char> used(m + 1);
+		for (int i = 1; i <= n; i++){
+			p[0] = i;
+			int j0 = 0;
+			std::fill(minv.begin(), minv.end(), inf);
+			std::fill(used.begin(), used.end(), 0);
+			do{
+				used[j0] = 1;
+				int i0 = p[j0];
+				const float* a_row = a + (i0 - 1) * m;
+				double delta = inf;
+				int j1 = 0;
+				for (int j = 1; j <= m; j++){
+					if (used[j])
+						continue;
+					double cur = a_row[j - 1] - u[i0] - v[j];
+					if (cur < minv[j]){
+						minv[j] = cur;
+						way[j] = j0;
+					}
+					if (minv[j] < delta){
+						delta = minv[j];
+						j1 = j;
+					}
+				}
+				for (int j = 0; j <= m; j++){
+					if (used[j]){
+						u[p[j]] += delta;
+						v[j] -= delta;
+					}
+					else{
+						minv[j] -= delta;
+					}
+				}
+				j0 = j1;
+			} while (p[j0] != 0);
+
+			// augmenting path
+			do{
+				int j1 = way[j0];
+				p[j0] = p[j1];
+				j0 = j1;
+			} while (j0 != 0);
+		}
+
+		float total_cost = 0;
+		for (int j = 1; j <= m; j++){
+			if (p[j] == 0)
+				continue;
+			int r = transposed ? j - 1 : p[j] - 1;
+			int c = transposed ? p[j] - 1 : j - 1;
+			assignment[r] = c;
+			total_cost += cost[r * cols + c];
+		}
+		return total_cost;
+	}
+
+
+
+	// optimal assignment of one image into binded_index[0..D) and overlap_score[0..D)
+	static void BindByAssignment(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth,
+		int* binded_index, float* overlap_score)
+	{
+		int D = detect_positions.size();
+		int G = ground_truth.size();
+
+		// rows: detections, cols: ground truth
+		std::vector<float> score_matrix(D * G + 1);
+		std::vector<float> cost_matrix(D * G);
+		RectArray gt_array;
+		gt_array.assign(ground_truth);
+		for (int d = 0; d < D; d++){
+			calcRectOverlaps(detect_positions[d], gt_array, &score_matrix[d * G]);
+			for (int g = 0; g < G; g++){
+				cost_matrix[d * G + g] = 1 - score_matrix[d * G + g];
+			}
+		}
+
+		std::vector<int> assignment;
+		KuhnMunkres(cost_matrix.empty() ? 0 : &cost_matrix[0], D, G, assignment);
+
+		for (int d = 0; d < D; d++){
+			binded_index[d] = assignment[d];
+			overlap_score[d] = 0;
+			if (assignment[d] >= 0)
+				overlap_score[d] = score_matrix[d * G + assignment[d]];
+		}
+		util::ProfileCount(util::COUNT_OVERLAPS, (long long)D * G);
+		util::ProfileCount(util::COUNT_ASSIGNMENTS, std::min(D, G));
+	}
+
+
 	// oIuWFNgGround Truthf[^т
-	void bindRectPairs(const std::vector<cv::Rect>& detect_positions, const std::vector<cv::Rect>& ground_truth,
+	void bindRectPairs(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth,
 		std::vector<int>& binded_index, std::vector<float>& overlap_score)
 	{
-		int w = detect_positions.size();
-		int h = ground_truth.size();
-		if (h < w)
-			h = w;
-		else if (w < h)
-			w = h;
+		binded_index.resize(detect_positions.size());
+		overlap_score.resize(detect_positions.size());
+		BindByAssignment(detect_positions, ground_truth, binded_index.data(), overlap_score.data());
+	}
+	
+
 
-		cv::Mat score_matrix = cv::Mat::zeros(h, w, CV_32FC1);
-		for (int r = 0; r < ground_truth.size(); r++){
-			for (int c = 0; c < detect_positions.size(); c++){
-				score_matrix.at<float>(r, c) = calcRectOverlap(detect_positions[c], ground_truth[r]);
+	// Unbound ground truth with the largest overlap above overlap_threshold, -1 if there is none
+	static int FindBestMatch(const float* overlaps, const std::vector<bool>& gt_check, float overlap_threshold, float* max_score)
+	{
+		*max_score = overlap_threshold;
+		int max_j = -1;
+		for (int j = 0; j < gt_check.size(); j++){
+			if (gt_check[j])
+				continue;
+			if (overlaps[j] > *max_score){
+				*max_score = overlaps[j];
+				max_j = j;
 			}
 		}
-		cv::Mat cost_matrix = -score_matrix + 1;
+		return max_j;
+	}
 
-		std::vector<int> permutation;
-		HangarianAlgorithm(cost_matrix, permutation);
 
-		binded_index.resize(detect_positions.size());
-		overlap_score.resize(detect_positions.size(), 0);
-		for (int i = 0; i < detect_positions.size(); i++){
-			binded_index[i] = permutation[i];
-			if (permutation[i] >= 0)
-				overlap_score[i] = score_matrix.at<float>(permutation[i], i);
-			if (permutation[i] >= ground_truth.size())
-				binded_index[i] = -1;
+	// FindBestMatch() over the candidates of a RectGrid query only; the other
+	// ground truth has overlap 0, which never exceeds a threshold >= 0
+	static int FindBestCandidate(const cv::Rect& rect, util::Span<cv::Rect> ground_truth,
+		const std::vector<int>& candidates, const std::vector<bool>& gt_check, float overlap_threshold, float* max_score)
+	{
+		*max_score = overlap_threshold;
+		int max_j = -1;
+		for (int i = 0; i < candidates.size(); i++){
+			int j = candidates[i];
+			if (gt_check[j])
+				continue;
+			float overlap = calcRectOverlap(rect, ground_truth[j]);
+			if (overlap > *max_score){
+				*max_score = overlap;
+				max_j = j;
+			}
 		}
+		return max_j;
 	}
-	
 
 
-	// oIuWFNgGround Truthf[^т
-	void bindRectPairs(const std::vector<cv::Rect>& detect_positions, const std::vector<cv::Rect>& ground_truth, const std::vector<float>& scores,
-		std::vector<int>& binded_index, std::vector<float>& overlap_score, float overlap_threshold)
+	// images with at least this many ground truth are matched through a RectGrid
+	static const int GRID_MIN_GROUND_TRUTH = 64;
+
+
+	// greedy binding of one image into binded_index[0..D) and overlap_score[0..D)
+	static void BindGreedy(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth, util::Span<float> scores,
+		int* binded_index, float* overlap_score, float overlap_threshold)
 	{
 		assert(scores.empty() || detect_positions.size() == scores.size());
 
 		if (scores.empty()){
-			bindRectPairs(detect_positions, ground_truth, binded_index, overlap_score);
+			BindByAssignment(detect_positions, ground_truth, binded_index, overlap_score);
 			return;
 		}
 
 		std::vector<int> idx;
-		util::argsort_vector(scores, idx);
+		util::argsort_vector(scores.data, scores.size(), idx);
 		std::vector<bool> gt_check(ground_truth.size(), false);
-		binded_index.resize(detect_positions.size());
-		overlap_score.resize(detect_positions.size());
+
+		// the grid skips ground truth of overlap 0, so results stay the same
+		bool use_grid = ground_truth.size() >= GRID_MIN_GROUND_TRUTH && overlap_threshold >= 0;
+		RectGrid gt_grid;
+		RectArray gt_array;
+		if (use_grid)
+			gt_grid.assign(ground_truth);
+		else
+			gt_array.assign(ground_truth);
+		std::vector<float> ol_scores(ground_truth.size() + 1);
+		std::vector<int> candidates;
+		long long overlap_num = 0;
+		int assigned = 0;
 		for (int i = idx.size() - 1; i >= 0; i--){
 			int detect_id = idx[i];
-			cv::Rect detect_rect = detect_positions[detect_id];
-			float max_score = overlap_threshold;
-			int max_j = -1;
-			for (int j = 0; j < ground_truth.size(); j++){
-				if (gt_check[j])
-					continue;
-				float ol_score = calcRectOverlap(detect_rect, ground_truth[j]);
-				if (ol_score > max_score){
-					max_score = ol_score;
-					max_j = j;
-				}
+			float max_score;
+			int max_j;
+			if (use_grid){
+				gt_grid.query(detect_positions[detect_id], candidates);
+				max_j = FindBestCandidate(detect_positions[detect_id], ground_truth, candidates, gt_check, overlap_threshold, &max_score);
+				overlap_num += candidates.size();
+			}
+			else{
+				calcRectOverlaps(detect_positions[detect_id], gt_array, &ol_scores[0]);
+				max_j = FindBestMatch(&ol_scores[0], gt_check, overlap_threshold, &max_score);
+				overlap_num += ground_truth.size();
 			}
 			binded_index[detect_id] = max_j;
 			overlap_score[detect_id] = 0;
 			if (max_j >= 0){
 				gt_check[max_j] = true;
 				overlap_score[detect_id] = max_score;
+				assigned++;
 			}
 		}
+		util::ProfileCount(util::COUNT_OVERLAPS, overlap_num);
+		util::ProfileCount(util::COUNT_ASSIGNMENTS, assigned);
+	}
+
+
+	// ratio of the area of rect inside region (0 for rect without area)
+	static float calcRectCoverage(const cv::Rect& rect, const cv::Rect& region)
+	{
+		long long width = std::min(rect.x + rect.width, region.x + region.width) - std::max(rect.x, region.x);
+		long long height = std::min(rect.y + rect.height, region.y + region.height) - std::max(rect.y, region.y);
+		long long area = (long long)rect.width * rect.height;
+		if (width <= 0 || height <= 0 || area <= 0)
+			return 0;
+		return (float)((double)(width * height) / area);
+	}
+
+
+	// BindGreedy() on the ground truth not marked difficult; detections left unbound (or bound
+	// at an overlap not above overlap_threshold) that hit a difficult ground truth or an ignore
+	// region become IGNORED_DETECTION
+	static void BindWithIgnore(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth, util::Span<float> scores,
+		util::Span<char> difficult, util::Span<cv::Rect> regions,
+		int* binded_index, float* overlap_score, float overlap_threshold)
+	{
+		std::vector<cv::Rect> regular, hard;
+		std::vector<int> regular_index;
+		for (int g = 0; g < ground_truth.size(); g++){
+			if (!difficult.empty() && difficult[g]){
+				hard.push_back(ground_truth[g]);
+			}
+			else{
+				regular.push_back(ground_truth[g]);
+				regular_index.push_back(g);
+			}
+		}
+		BindGreedy(detect_positions, regular, scores, binded_index, overlap_score, overlap_threshold);
+
+		RectArray hard_array;
+		hard_array.assign(hard);
+		std::vector<float> hard_overlaps(hard.size() + 1);
+		long long overlap_num = 0;
+		for (int d = 0; d < detect_positions.size(); d++){
+			if (binded_index[d] >= 0)
+				binded_index[d] = regular_index[binded_index[d]];
+			if (binded_index[d] >= 0 && overlap_score[d] > overlap_threshold)
+				continue;
+
+			bool ignored = false;
+			if (!hard.empty()){
+				calcRectOverlaps(detect_positions[d], hard_array, &hard_overlaps[0]);
+				overlap_num += hard.size();
+				for (int h = 0; h < hard.size() && !ignored; h++)
+					ignored = hard_overlaps[h] > overlap_threshold;
+			}
+			for (int r = 0; r < regions.size() && !ignored; r++)
+				ignored = calcRectCoverage(detect_positions[d], regions[r]) > overlap_threshold;
+			if (ignored){
+				binded_index[d] = IGNORED_DETECTION;
+				overlap_score[d] = 0;
+			}
+		}
+		util::ProfileCount(util::COUNT_OVERLAPS, overlap_num);
+	}
+
+
+	// oIuWFNgGround Truthf[^т
+	void bindRectPairs(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth, util::Span<float> scores,
+		std::vector<int>& binded_index, std::vector<float>& overlap_score, float overlap_threshold)
+	{
+		binded_index.resize(detect_positions.size());
+		overlap_score.resize(detect_positions.size());
+		BindGreedy(detect_positions, ground_truth, scores, binded_index.data(), overlap_score.data(), overlap_threshold);
 	}
 	
 
@@ -242,25 +757,173 @@ namespace eval{
 		std::vector<std::vector<float>>& overlap_score,
 		int* ground_truth_num, float overlap_threshold)
 	{
+		util::ScopedTimer timer("bindRectPairs");
 		assert(detect_positions.size() == ground_truth.size());
 		assert(scores.empty() || scores.size() == ground_truth.size());
 
 		int N = detect_positions.size();
 		binded_index.resize(N);
 		overlap_score.resize(N);
-		*ground_truth_num = 0;
-		for (int n = 0; n < N; n++){
+		util::parallel_for(0, N, [&](int n){
 			if (scores.empty()){
 				bindRectPairs(detect_positions[n], ground_truth[n], binded_index[n], overlap_score[n]);
 			}
 			else{
 				bindRectPairs(detect_positions[n], ground_truth[n], scores[n], binded_index[n], overlap_score[n], overlap_threshold);
 			}
+		}, num_threads_);
+
+		*ground_truth_num = 0;
+		for (int n = 0; n < N; n++){
 			*ground_truth_num += ground_truth[n].size();
 		}
 	}
 
-	
+
+	void bindRectPairs(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		util::FlatList<int>& binded_index,
+		util::FlatList<float>& overlap_score,
+		int* ground_truth_num, float overlap_threshold)
+	{
+		util::ScopedTimer timer("bindRectPairs");
+		assert(detect_positions.size() == ground_truth.size());
+		assert(scores.empty() || scores.size() == ground_truth.size());
+
+		int N = detect_positions.size();
+		binded_index.reshape(detect_positions);
+		overlap_score.reshape(detect_positions);
+		util::parallel_for(0, N, [&](int n){
+			BindGreedy(detect_positions[n], ground_truth[n], scores.empty() ? util::Span<float>() : scores[n],
+				binded_index.at(n), overlap_score.at(n), overlap_threshold);
+		}, num_threads_);
+
+		*ground_truth_num = ground_truth.data.size();
+	}
+
+
+	void bindRectPairs(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		const GroundTruthIgnore& ignore,
+		util::FlatList<int>& binded_index,
+		util::FlatList<float>& overlap_score,
+		int* ground_truth_num, float overlap_threshold)
+	{
+		if (ignore.empty()){
+			bindRectPairs(detect_positions, ground_truth, scores, binded_index, overlap_score, ground_truth_num, overlap_threshold);
+			return;
+		}
+
+		util::ScopedTimer timer("bindRectPairs");
+		assert(detect_positions.size() == ground_truth.size());
+		assert(scores.empty() || scores.size() == ground_truth.size());
+		assert(ignore.difficult.data.empty() || ignore.difficult.offsets == ground_truth.offsets);
+		assert(ignore.regions.data.empty() || ignore.regions.size() == ground_truth.size());
+
+		int N = detect_positions.size();
+		bool has_difficult = !ignore.difficult.data.empty();
+		bool has_regions = !ignore.regions.data.empty();
+		binded_index.reshape(detect_positions);
+		overlap_score.reshape(detect_positions);
+		util::parallel_for(0, N, [&](int n){
+			util::Span<char> difficult = has_difficult ? ignore.difficult[n] : util::Span<char>();
+			util::Span<cv::Rect> regions = has_regions ? ignore.regions[n] : util::Span<cv::Rect>();
+			util::Span<float> image_scores = scores.empty() ? util::Span<float>() : scores[n];
+			if (std::find(difficult.begin(), difficult.end(), 1) == difficult.end() && regions.empty())
+				BindGreedy(detect_positions[n], ground_truth[n], image_scores, binded_index.at(n), overlap_score.at(n), overlap_threshold);
+			else
+				BindWithIgnore(detect_positions[n], ground_truth[n], image_scores, difficult, regions,
+					binded_index.at(n), overlap_score.at(n), overlap_threshold);
+		}, num_threads_);
+
+		*ground_truth_num = ground_truth.data.size() -
+			std::count(ignore.difficult.data.begin(), ignore.difficult.data.end(), 1);
+	}
+
+
+	float AveragePrecisionSweep(const std::vector<std::vector<cv::Rect>>& detect_positions,
+		const std::vector<std::vector<cv::Rect>>& ground_truth,
+		const std::vector<std::vector<float>>& scores,
+		const std::vector<float>& overlap_thresholds,
+		std::vector<float>& average_precisions)
+	{
+		util::FlatList<cv::Rect> flat_detect_positions, flat_ground_truth;
+		util::FlatList<float> flat_scores;
+		flat_detect_positions.assign(detect_positions);
+		flat_ground_truth.assign(ground_truth);
+		flat_scores.assign(scores);
+		return AveragePrecisionSweep(flat_detect_positions, flat_ground_truth, flat_scores, overlap_thresholds, average_precisions);
+	}
+
+
+	float AveragePrecisionSweep(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		const std::vector<float>& overlap_thresholds,
+		std::vector<float>& average_precisions)
+	{
+		util::ScopedTimer timer("AveragePrecisionSweep");
+		assert(detect_positions.size() == ground_truth.size());
+		assert(scores.size() == ground_truth.size());
+		assert(scores.offsets == detect_positions.offsets);
+
+		int N = detect_positions.size();
+		int T = overlap_thresholds.size();
+		const std::vector<int>& offsets = detect_positions.offsets;
+		int ground_truth_num = ground_truth.data.size();
+
+		// true positive flag of every detection at every threshold
+		std::vector<std::vector<char>> true_positive(T, std::vector<char>(offsets[N]));
+		util::parallel_for(0, N, [&](int n){
+			int D = detect_positions[n].size();
+			int G = ground_truth[n].size();
+			std::vector<float> overlaps(D * G + 1);
+			RectArray gt_array;
+			gt_array.assign(ground_truth[n]);
+			for (int d = 0; d < D; d++){
+				calcRectOverlaps(detect_positions[n][d], gt_array, &overlaps[d * G]);
+			}
+
+			std::vector<int> idx;
+			util::argsort_vector(scores[n].data, D, idx);
+			int assigned = 0;
+			for (int t = 0; t < T; t++){
+				std::vector<bool> gt_check(G, false);
+				for (int i = D - 1; i >= 0; i--){
+					int detect_id = idx[i];
+					float max_score;
+					int max_j = FindBestMatch(&overlaps[detect_id * G], gt_check, overlap_thresholds[t], &max_score);
+					if (max_j >= 0){
+						gt_check[max_j] = true;
+						assigned++;
+					}
+					true_positive[t][offsets[n] + detect_id] = (max_j >= 0);
+				}
+			}
+			util::ProfileCount(util::COUNT_OVERLAPS, (long long)D * G);
+			util::ProfileCount(util::COUNT_ASSIGNMENTS, assigned);
+		}, num_threads_);
+
+		average_precisions.clear();
+		float total_ap = 0;
+		std::vector<ScoredDetection> detections(offsets[N]);
+		for (int t = 0; t < T; t++){
+			for (int i = 0; i < offsets[N]; i++){
+				detections[i].score = scores.data[i];
+				detections[i].true_positive = true_positive[t][i] != 0;
+			}
+			std::vector<float> recall, precision, thresholds;
+			float ap = RecallPrecision(detections, ground_truth_num, recall, precision, thresholds);
+			average_precisions.push_back(ap);
+			total_ap += ap;
+		}
+
+		return T > 0 ? total_ap / T : 0;
+	}
+
+
 /*	// oIuWFNgGround Truthf[^т
 	void bindRectPairs(const std::vector<std::vector<cv::Rect>>& detect_positions,
 		const std::vector<std::vector<cv::Rect>>& ground_truth,
@@ -285,8 +948,19 @@ namespace eval{
 	{
 		assert(precision.size() == recall.size());
 		
-		std::vector<int> sort_idx;
-		util::argsort_vector(recall, sort_idx);
+		// ascending recall by std::sort on the recall alone, as in the first version of this function:
+		// the precision taken among equal recalls depends on the order of ties, so it is kept for the same AP
+		int R = recall.size();
+		std::vector<util::ARG_SORTER<float>> sort_pairs(R);
+		for (int i = 0; i < R; i++){
+			sort_pairs[i].val = recall[i];
+			sort_pairs[i].idx = i;
+		}
+		std::sort(sort_pairs.begin(), sort_pairs.end(),
+			[](const util::ARG_SORTER<float>& left, const util::ARG_SORTER<float>& right){ return left.val < right.val; });
+		std::vector<int> sort_idx(R);
+		for (int i = 0; i < R; i++)
+			sort_idx[i] = sort_pairs[i].idx;
 
 		float thresholds[11];
 		for (int t = 0; t <= 10; t++){
@@ -309,65 +983,361 @@ namespace eval{
 	}
 
 
+	float AveragePrecisionAllPoint(const std::vector<float>& precision, const std::vector<float>& recall)
+	{
+		assert(precision.size() == recall.size());
 
-	float RecallPrecision(const std::vector<std::vector<int>>& binded_idx, 
-		const std::vector<std::vector<float>>& scores, 
+		// points with a higher recall come first, so the interpolated precision is a running maximum
+		int N = recall.size();
+		float max_precision = 0;
+		float total = 0;
+		for (int i = 0; i < N; i++){
+			max_precision = std::max(max_precision, precision[i]);
+			float next_recall = (i + 1 < N) ? recall[i + 1] : 0;
+			total += (recall[i] - next_recall) * max_precision;
+		}
+		return total;
+	}
+
+
+	// AveragePrecision() or AveragePrecisionAllPoint() by the mode
+	static float CurveAveragePrecision(std::vector<float>& precision, std::vector<float>& recall)
+	{
+		if (ap_mode_ == AP_ALL_POINT)
+			return AveragePrecisionAllPoint(precision, recall);
+		return AveragePrecision(precision, recall);
+	}
+
+
+	// indices of the points DecimateCurve() keeps with max_error, at most limit + 1 of them are collected
+	static int KeepCurvePoints(const std::vector<float>& recall, const std::vector<float>& precision,
+		float max_error, int limit, std::vector<int>& kept)
+	{
+		int N = recall.size();
+		kept.clear();
+		if (N == 0)
+			return 0;
+		kept.push_back(0);
+		for (int i = 1; i < N - 1 && kept.size() <= limit; i++){
+			int last = kept.back();
+			if (std::abs(recall[i] - recall[last]) > max_error || std::abs(precision[i] - precision[last]) > max_error)
+				kept.push_back(i);
+		}
+		if (N > 1)
+			kept.push_back(N - 1);
+		return kept.size();
+	}
+
+
+	void DecimateCurve(std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds,
+		float max_error, int max_points)
+	{
+		util::ScopedTimer timer("DecimateCurve");
+		assert(recall.size() == precision.size());
+		assert(recall.size() == thresholds.size());
+
+		int N = recall.size();
+		int limit = max_points > 0 ? std::max(max_points, 2) : N;
+		std::vector<int> kept;
+		if (KeepCurvePoints(recall, precision, max_error, limit, kept) > limit){
+			// recall and precision are in [0, 1], so an error of 1 keeps only the end points
+			float low = max_error, high = 1;
+			for (int iter = 0; iter < 32; iter++){
+				float middle = (low + high) / 2;
+				if (KeepCurvePoints(recall, precision, middle, limit, kept) > limit)
+					low = middle;
+				else
+					high = middle;
+			}
+			KeepCurvePoints(recall, precision, high, limit, kept);
+		}
+
+		for (int i = 0; i < kept.size(); i++){
+			recall[i] = recall[kept[i]];
+			precision[i] = precision[kept[i]];
+			thresholds[i] = thresholds[kept[i]];
+		}
+		recall.resize(kept.size());
+		precision.resize(kept.size());
+		thresholds.resize(kept.size());
+	}
+
+
+
+	static bool CompareScore(const ScoredDetection& left, const ScoredDetection& right)
+	{
+		return left.score < right.score;
+	}
+
+
+	void CollectScoredDetections(util::Span<int> binded_idx,
+		util::Span<float> scores,
+		util::Span<float> overlap_score,
+		std::vector<ScoredDetection>& detections,
+		float overlap_threshold)
+	{
+		assert(scores.size() == binded_idx.size());
+
+		for (int i = 0; i < scores.size(); i++){
+			if (binded_idx[i] == IGNORED_DETECTION)
+				continue;
+			ScoredDetection det;
+			det.score = scores[i];
+			det.true_positive = (binded_idx[i] >= 0 && overlap_score[i] > overlap_threshold);
+			detections.push_back(det);
+		}
+	}
+
+
+	void CollectScoredDetections(const std::vector<std::vector<int>>& binded_idx,
+		const std::vector<std::vector<float>>& scores,
 		const std::vector<std::vector<float>>& overlap_score,
-		int ground_truth_num,
-		std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds,
+		std::vector<ScoredDetection>& detections,
 		float overlap_threshold)
 	{
-		if (scores.empty())
-			return -1;
+		assert(binded_idx.size() == overlap_score.size());
+		assert(scores.size() == binded_idx.size());
+
+		detections.clear();
+		detections.reserve(util::CountVectorElements(scores));
+		for (int n = 0; n < binded_idx.size(); n++){
+			CollectScoredDetections(binded_idx[n], scores[n], overlap_score[n], detections, overlap_threshold);
+		}
+	}
+
 
+	void CollectScoredDetections(const util::FlatList<int>& binded_idx,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_score,
+		std::vector<ScoredDetection>& detections,
+		float overlap_threshold)
+	{
 		assert(binded_idx.size() == overlap_score.size());
 		assert(scores.size() == binded_idx.size());
 
-		std::vector<float> score_list;
-		for (int i = 0; i < binded_idx.size(); i++){
-			score_list.insert(score_list.end(), scores[i].begin(), scores[i].end());
+		detections.clear();
+		detections.reserve(scores.data.size());
+		for (int n = 0; n < binded_idx.size(); n++){
+			CollectScoredDetections(binded_idx[n], scores[n], overlap_score[n], detections, overlap_threshold);
 		}
+	}
+
 
-		std::sort(score_list.begin(), score_list.end());
+	float RecallPrecision(std::vector<ScoredDetection>& detections, int ground_truth_num,
+		std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds)
+	{
+		util::ScopedTimer timer("RecallPrecision");
+		if (!std::is_sorted(detections.begin(), detections.end(), CompareScore))
+			std::sort(detections.begin(), detections.end(), CompareScore);
+
+		// true positives among detections[i..N-1]
+		int N = detections.size();
+		std::vector<int> true_positive_tail(N + 1, 0);
+		for (int i = N - 1; i >= 0; i--){
+			true_positive_tail[i] = true_positive_tail[i + 1] + (detections[i].true_positive ? 1 : 0);
+		}
+
+		// thresholds are the midpoints between unique scores, same as evaluating
+		// EvaluateDetection() at each of them, but counted in one sweep
 		float prev = 0;
-		for (int i = 0; i < score_list.size(); i++){
-			float th = score_list[i];
+		int above = 0;
+		int swept = 0;
+		for (int i = 0; i < N; i++){
+			float th = detections[i].score;
 			if (th == prev)
 				continue;
 			float th2 = (th + prev) / 2;
-			std::vector<std::vector<int>> true_positive_id, false_positive_id;
-			
-			EvaluateDetection(binded_idx, scores, overlap_score, true_positive_id, false_positive_id, th2, overlap_threshold);
+			// the first threshold (th + 0) / 2 is above the next ones when scores are negative,
+			// so the sweep starts over for the midpoints, which rise from there on
+			if (swept == 1)
+				above = 0;
+			while (above < N && !(detections[above].score > th2))
+				above++;
 
-			int true_positive_num = util::CountVectorElements(true_positive_id);
-			int false_positive_num = util::CountVectorElements(false_positive_id);
+			int true_positive_num = true_positive_tail[above];
+			int false_positive_num = N - above - true_positive_num;
 
 			prev = th;
 			thresholds.push_back(th2);
 			recall.push_back((float)true_positive_num / ground_truth_num);
 			precision.push_back((float)true_positive_num / (true_positive_num + false_positive_num));
+			swept++;
 		}
+		util::ProfileCount(util::COUNT_THRESHOLDS, swept);
 
-		return AveragePrecision(precision, recall);
+		return CurveAveragePrecision(precision, recall);
+	}
+
+
+	void MergeScoredDetections(std::vector<ScoredDetection>& sorted_detections,
+		std::vector<ScoredDetection>& added)
+	{
+		std::sort(added.begin(), added.end(), CompareScore);
+		size_t middle = sorted_detections.size();
+		sorted_detections.insert(sorted_detections.end(), added.begin(), added.end());
+		std::inplace_merge(sorted_detections.begin(), sorted_detections.begin() + middle,
+			sorted_detections.end(), CompareScore);
+	}
+
+
+	float BootstrapAveragePrecision(const util::FlatList<int>& binded_idx,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_score,
+		const util::FlatList<cv::Rect>& ground_truth,
+		int resample_num, unsigned int seed,
+		std::vector<float>& average_precisions,
+		float overlap_threshold)
+	{
+		util::ScopedTimer timer("BootstrapAveragePrecision");
+		assert(binded_idx.size() == ground_truth.size());
+
+		assert(binded_idx.data.size() == scores.data.size());
+		assert(overlap_score.data.size() == scores.data.size());
+
+		// detections that are not ignored, with the image they belong to, sorted by score
+		int N = binded_idx.size();
+		std::vector<float> kept_score;
+		std::vector<int> kept_image;
+		std::vector<char> kept_true_positive;
+		kept_score.reserve(scores.data.size());
+		kept_image.reserve(scores.data.size());
+		kept_true_positive.reserve(scores.data.size());
+		for (int n = 0; n < N; n++){
+			for (int i = binded_idx.offsets[n]; i < binded_idx.offsets[n + 1]; i++){
+				if (binded_idx.data[i] == IGNORED_DETECTION)
+					continue;
+				kept_score.push_back(scores.data[i]);
+				kept_image.push_back(n);
+				kept_true_positive.push_back(binded_idx.data[i] >= 0 && overlap_score.data[i] > overlap_threshold);
+			}
+		}
+		int M = kept_score.size();
+		std::vector<int> order;
+		util::argsort(kept_score.empty() ? 0 : &kept_score[0], M, order, util::SORT_ASCENDING, num_threads_);
+		std::vector<float> sorted_score(M);
+		std::vector<int> sorted_image(M);
+		std::vector<char> sorted_true_positive(M);
+		for (int i = 0; i < M; i++){
+			sorted_score[i] = kept_score[order[i]];
+			sorted_image[i] = kept_image[order[i]];
+			sorted_true_positive[i] = kept_true_positive[order[i]];
+		}
+
+		average_precisions.assign(resample_num, 0);
+		if (N == 0)
+			return 0;
+
+		// one block of resamples per thread, buffers allocated once per block
+		int T = num_threads_ > 0 ? num_threads_ : util::hardware_threads();
+		T = std::max(1, std::min(T, resample_num));
+		util::parallel_for(0, T, [&](int t){
+			std::vector<int> weight(N);
+			std::vector<float> recall, precision, thresholds;
+			std::uniform_int_distribution<int> draw(0, N - 1);
+			for (int k = t; k < resample_num; k += T){
+				std::seed_seq seq = { seed, (unsigned int)k };
+				std::mt19937 rng(seq);
+				draw.reset();
+				std::fill(weight.begin(), weight.end(), 0);
+				for (int n = 0; n < N; n++)
+					weight[draw(rng)]++;
+
+				int ground_truth_num = 0, detection_num = 0, true_positive_num = 0;
+				for (int n = 0; n < N; n++)
+					ground_truth_num += weight[n] * ground_truth.count(n);
+				for (int i = 0; i < M; i++){
+					int w = weight[sorted_image[i]];
+					detection_num += w;
+					true_positive_num += sorted_true_positive[i] ? w : 0;
+				}
+
+				// the sweep of RecallPrecision() with each detection counted weight times
+				recall.clear();
+				precision.clear();
+				thresholds.clear();
+				float prev = 0;
+				int above = 0, below_num = 0, below_true_positive = 0, swept = 0;
+				for (int i = 0; i < M; i++){
+					if (weight[sorted_image[i]] == 0)
+						continue;
+					float th = sorted_score[i];
+					if (th == prev)
+						continue;
+					float th2 = (th + prev) / 2;
+					if (swept == 1){
+						// start over after the first threshold, as RecallPrecision()
+						above = below_num = below_true_positive = 0;
+					}
+					while (above < M && !(sorted_score[above] > th2)){
+						int w = weight[sorted_image[above]];
+						below_num += w;
+						below_true_positive += sorted_true_positive[above] ? w : 0;
+						above++;
+					}
+
+					int tp = true_positive_num - below_true_positive;
+					int fp = detection_num - below_num - tp;
+					prev = th;
+					thresholds.push_back(th2);
+					recall.push_back((float)tp / ground_truth_num);
+					precision.push_back((float)tp / (tp + fp));
+					swept++;
+				}
+				average_precisions[k] = CurveAveragePrecision(precision, recall);
+			}
+		}, T, 1);
+
+		float total_ap = 0;
+		for (int k = 0; k < resample_num; k++)
+			total_ap += average_precisions[k];
+		return resample_num > 0 ? total_ap / resample_num : 0;
+	}
+
+
+	float RecallPrecision(const std::vector<std::vector<int>>& binded_idx, 
+		const std::vector<std::vector<float>>& scores, 
+		const std::vector<std::vector<float>>& overlap_score,
+		int ground_truth_num,
+		std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds,
+		float overlap_threshold)
+	{
+		if (scores.empty())
+			return -1;
+
+		std::vector<ScoredDetection> detections;
+		CollectScoredDetections(binded_idx, scores, overlap_score, detections, overlap_threshold);
+
+		return RecallPrecision(detections, ground_truth_num, recall, precision, thresholds);
+	}
+
+
+	// 1: true positive, -1: false positive, 0: ignored or score not above threshold (score is null without scores)
+	static inline int DetectionLabel(int binded_index, const float* score, float overlap_score,
+		float threshold, float overlap_threshold)
+	{
+		if (binded_index == IGNORED_DETECTION || (score && !(*score > threshold)))
+			return 0;
+		return (binded_index >= 0 && overlap_score > overlap_threshold) ? 1 : -1;
 	}
 
 
-	void EvaluateDetection(const std::vector<int>& binded_index, const std::vector<float>& overlap_scores,
+	void EvaluateDetection(util::Span<int> binded_index, util::Span<float> overlap_scores,
 		std::vector<int>& true_positive_id, std::vector<int>& false_positive_id, float overlap_threshold)
 	{
 		assert(binded_index.size() == overlap_scores.size());
 
 		for (int i = 0; i < binded_index.size(); i++){
-			if (binded_index[i] >= 0 && overlap_scores[i] > overlap_threshold)
+			int label = DetectionLabel(binded_index[i], 0, overlap_scores[i], 0, overlap_threshold);
+			if (label > 0)
 				true_positive_id.push_back(i);
-			else
+			else if (label < 0)
 				false_positive_id.push_back(i);
 		}
 	}
 
 
-	void EvaluateDetection(const std::vector<int>& binded_index, const std::vector<float>& scores,
-		const std::vector<float>& overlap_scores,
+	void EvaluateDetection(util::Span<int> binded_index, util::Span<float> scores,
+		util::Span<float> overlap_scores,
 		std::vector<int>& true_positive_id, std::vector<int>& false_positive_id,
 		float threshold, float overlap_threshold)
 	{
@@ -375,12 +1345,11 @@ namespace eval{
 		assert(scores.size() == binded_index.size());
 
 		for (int i = 0; i< binded_index.size(); i++){
-			if (scores[i] > threshold){
-				if (binded_index[i] >= 0 && overlap_scores[i] > overlap_threshold)
-					true_positive_id.push_back(i);
-				else
-					false_positive_id.push_back(i);
-			}
+			int label = DetectionLabel(binded_index[i], &scores[i], overlap_scores[i], threshold, overlap_threshold);
+			if (label > 0)
+				true_positive_id.push_back(i);
+			else if (label < 0)
+				false_positive_id.push_back(i);
 		}
 	}
 
@@ -393,20 +1362,74 @@ namespace eval{
 		float threshold,
 		float overlap_threshold)
 	{
+		util::ScopedTimer timer("EvaluateDetection");
 		assert(binded_index.size() == overlap_scores.size());
 		assert(scores.empty() || scores.size() == binded_index.size());
 
 		int N = binded_index.size();
 		true_positive_id.resize(N);
 		false_positive_id.resize(N);
-		int total_true_positive_num = 0;
-		for (int n = 0; n < binded_index.size(); n++){
+		util::parallel_for(0, N, [&](int n){
 			if (scores.empty()){
 				EvaluateDetection(binded_index[n], overlap_scores[n], true_positive_id[n], false_positive_id[n], overlap_threshold);
 			}
 			else{
 				EvaluateDetection(binded_index[n], scores[n], overlap_scores[n], true_positive_id[n], false_positive_id[n], threshold, overlap_threshold);
 			}
+		}, num_threads_);
+	}
+
+
+	void EvaluateDetection(const util::FlatList<int>& binded_index,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_scores,
+		util::FlatList<int>& true_positive_id,
+		util::FlatList<int>& false_positive_id,
+		float threshold,
+		float overlap_threshold)
+	{
+		util::ScopedTimer timer("EvaluateDetection");
+		assert(binded_index.size() == overlap_scores.size());
+		assert(scores.empty() || scores.size() == binded_index.size());
+
+		// count true and false positives of each image, then fill the flat buffers
+		int N = binded_index.size();
+		true_positive_id.offsets.assign(N + 1, 0);
+		false_positive_id.offsets.assign(N + 1, 0);
+		for (int pass = 0; pass < 2; pass++){
+			util::parallel_for(0, N, [&](int n){
+				util::Span<int> binded = binded_index[n];
+				util::Span<float> overlaps = overlap_scores[n];
+				const float* image_scores = scores.empty() ? 0 : scores[n].data;
+				int* tp = pass == 0 ? 0 : true_positive_id.at(n);
+				int* fp = pass == 0 ? 0 : false_positive_id.at(n);
+				int tp_num = 0, fp_num = 0;
+				for (int i = 0; i < binded.size(); i++){
+					int label = DetectionLabel(binded[i], image_scores ? &image_scores[i] : 0, overlaps[i], threshold, overlap_threshold);
+					if (label > 0){
+						if (tp)
+							tp[tp_num] = i;
+						tp_num++;
+					}
+					else if (label < 0){
+						if (fp)
+							fp[fp_num] = i;
+						fp_num++;
+					}
+				}
+				if (pass == 0){
+					true_positive_id.offsets[n + 1] = tp_num;
+					false_positive_id.offsets[n + 1] = fp_num;
+				}
+			}, num_threads_);
+			if (pass == 0){
+				for (int n = 0; n < N; n++){
+					true_positive_id.offsets[n + 1] += true_positive_id.offsets[n];
+					false_positive_id.offsets[n + 1] += false_positive_id.offsets[n];
+				}
+				true_positive_id.data.resize(true_positive_id.offsets[N]);
+				false_positive_id.data.resize(false_positive_id.offsets[N]);
+			}
 		}
 	}
 
@@ -451,8 +1474,219 @@ namespace eval{
 	}
 
 
-	void ThresholdDetectPositions(const std::vector<cv::Rect>& detect_positions,
-		const std::vector<float>& scores, float threshold,
+	// rectangles of one (image, class) group
+	struct ClassGroups{
+		util::FlatList<cv::Rect> detections, ground_truth;
+		util::FlatList<float> scores;
+		GroundTruthIgnore ignore;			// difficult flags of the group and regions of its image
+		std::vector<int> detection_index;	// index in its image of each detection
+		std::vector<int> image_groups;		// groups of image n are image_groups[n] ... image_groups[n + 1] - 1
+		std::vector<int> group_class;
+	};
+
+
+	// dense class of each label, in the order of class_labels
+	static void DenseClasses(const std::vector<int>& labels, const std::vector<int>& class_labels, std::vector<int>& dense)
+	{
+		dense.resize(labels.size());
+		for (size_t i = 0; i < labels.size(); i++)
+			dense[i] = std::lower_bound(class_labels.begin(), class_labels.end(), labels[i]) - class_labels.begin();
+	}
+
+
+	static void GroupByClass(const util::FlatList<cv::Rect>& detect_positions, const std::vector<int>& detect_class,
+		const util::FlatList<cv::Rect>& ground_truth, const std::vector<int>& ground_truth_class,
+		const GroundTruthIgnore& ignore, const util::FlatList<float>& scores, int class_num, ClassGroups& groups)
+	{
+		util::ScopedTimer timer("GroupByClass");
+		int N = detect_positions.size();
+		bool has_score = !scores.empty();
+		bool has_difficult = !ignore.difficult.data.empty();
+		bool has_regions = !ignore.regions.data.empty();
+		std::vector<int> stamp(class_num, -1), group_of(class_num), present;
+
+		groups.image_groups.assign(1, 0);
+		groups.group_class.clear();
+		groups.detections.clear();
+		groups.ground_truth.clear();
+		groups.scores.clear();
+		groups.ignore.difficult.clear();
+		groups.ignore.regions.clear();
+		groups.detection_index.clear();
+		groups.detections.data.reserve(detect_positions.data.size());
+		groups.ground_truth.data.reserve(ground_truth.data.size());
+		groups.detection_index.reserve(detect_positions.data.size());
+		for (int n = 0; n < N; n++){
+			// classes in this image, in ascending order
+			present.clear();
+			for (int i = detect_positions.offsets[n]; i < detect_positions.offsets[n + 1]; i++){
+				if (stamp[detect_class[i]] != n){
+					stamp[detect_class[i]] = n;
+					present.push_back(detect_class[i]);
+				}
+			}
+			for (int i = ground_truth.offsets[n]; i < ground_truth.offsets[n + 1]; i++){
+				if (stamp[ground_truth_class[i]] != n){
+					stamp[ground_truth_class[i]] = n;
+					present.push_back(ground_truth_class[i]);
+				}
+			}
+			std::sort(present.begin(), present.end());
+
+			for (int k = 0; k < present.size(); k++){
+				int c = present[k];
+				for (int i = detect_positions.offsets[n]; i < detect_positions.offsets[n + 1]; i++){
+					if (detect_class[i] != c)
+						continue;
+					groups.detections.data.push_back(detect_positions.data[i]);
+					groups.detection_index.push_back(i - detect_positions.offsets[n]);
+					if (has_score)
+						groups.scores.data.push_back(scores.data[i]);
+				}
+				for (int i = ground_truth.offsets[n]; i < ground_truth.offsets[n + 1]; i++){
+					if (ground_truth_class[i] != c)
+						continue;
+					groups.ground_truth.data.push_back(ground_truth.data[i]);
+					if (has_difficult)
+						groups.ignore.difficult.data.push_back(ignore.difficult.data[i]);
+				}
+				groups.detections.offsets.push_back(groups.detections.data.size());
+				groups.ground_truth.offsets.push_back(groups.ground_truth.data.size());
+				if (has_score)
+					groups.scores.offsets.push_back(groups.scores.data.size());
+				if (has_difficult)
+					groups.ignore.difficult.offsets.push_back(groups.ignore.difficult.data.size());
+				if (has_regions)
+					groups.ignore.regions.push_back(ignore.regions[n]);
+				groups.group_class.push_back(c);
+			}
+			groups.image_groups.push_back(groups.group_class.size());
+		}
+	}
+
+
+	// indices of group detections back to indices in each image, in ascending order
+	static void UngroupIndices(const ClassGroups& groups, const util::FlatList<int>& group_id,
+		util::FlatList<int>& image_id)
+	{
+		int N = groups.image_groups.size() - 1;
+		image_id.clear();
+		image_id.data.reserve(group_id.data.size());
+		for (int n = 0; n < N; n++){
+			size_t begin = image_id.data.size();
+			for (int g = groups.image_groups[n]; g < groups.image_groups[n + 1]; g++){
+				const int* index = &groups.detection_index[0] + groups.detections.offsets[g];
+				for (int k = group_id.offsets[g]; k < group_id.offsets[g + 1]; k++)
+					image_id.data.push_back(index[group_id.data[k]]);
+			}
+			std::sort(image_id.data.begin() + begin, image_id.data.end());
+			image_id.offsets.push_back(image_id.data.size());
+		}
+	}
+
+
+	float EvaluateAll(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<int>& detect_labels,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<int>& ground_truth_labels,
+		const GroundTruthIgnore& ignore,
+		const util::FlatList<float>& scores,
+		float threshold,
+		util::FlatList<int>& true_positive_id,
+		util::FlatList<int>& false_positive_id,
+		std::vector<ClassResult>& classes,
+		float overlap_th)
+	{
+		util::ScopedTimer timer("EvaluateAll");
+		assert(detect_positions.size() == ground_truth.size());
+		assert(detect_labels.offsets == detect_positions.offsets);
+		assert(ground_truth_labels.offsets == ground_truth.offsets);
+
+		std::vector<int> class_labels(detect_labels.data);
+		class_labels.insert(class_labels.end(), ground_truth_labels.data.begin(), ground_truth_labels.data.end());
+		std::sort(class_labels.begin(), class_labels.end());
+		class_labels.erase(std::unique(class_labels.begin(), class_labels.end()), class_labels.end());
+		int C = class_labels.size();
+
+		std::vector<int> detect_class, ground_truth_class;
+		DenseClasses(detect_labels.data, class_labels, detect_class);
+		DenseClasses(ground_truth_labels.data, class_labels, ground_truth_class);
+
+		ClassGroups groups;
+		GroupByClass(detect_positions, detect_class, ground_truth, ground_truth_class, ignore, scores, C, groups);
+
+		util::FlatList<int> binded_index, group_true_positive_id, group_false_positive_id;
+		util::FlatList<float> overlap_score;
+		int ground_truth_num;
+		bindRectPairs(groups.detections, groups.ground_truth, groups.scores, groups.ignore, binded_index, overlap_score,
+			&ground_truth_num, overlap_th);
+		EvaluateDetection(binded_index, groups.scores, overlap_score, group_true_positive_id, group_false_positive_id,
+			threshold, overlap_th);
+		UngroupIndices(groups, group_true_positive_id, true_positive_id);
+		UngroupIndices(groups, group_false_positive_id, false_positive_id);
+
+		classes.resize(C);
+		for (int c = 0; c < C; c++){
+			classes[c].label = class_labels[c];
+			classes[c].ground_truth_num = 0;
+			classes[c].recall.clear();
+			classes[c].precision.clear();
+			classes[c].thresholds.clear();
+			classes[c].average_precision = 0;
+		}
+		for (int i = 0; i < ground_truth_class.size(); i++){
+			if (ignore.difficult.data.empty() || !ignore.difficult.data[i])
+				classes[ground_truth_class[i]].ground_truth_num++;
+		}
+		if (scores.empty())
+			return 0;
+
+		// one sort of all detections but the ignored ones, split by class in that order
+		std::vector<ScoredDetection> detections;
+		std::vector<float> detection_score;
+		std::vector<int> detection_class;
+		detections.reserve(groups.scores.data.size());
+		for (int g = 0; g < groups.group_class.size(); g++){
+			int begin = detections.size();
+			CollectScoredDetections(binded_index[g], groups.scores[g], overlap_score[g], detections);
+			detection_class.resize(detections.size(), groups.group_class[g]);
+			for (int k = begin; k < detections.size(); k++)
+				detection_score.push_back(detections[k].score);
+		}
+		int D = detections.size();
+		std::vector<int> order;
+		util::argsort(detection_score.empty() ? 0 : &detection_score[0], D, order, util::SORT_ASCENDING, num_threads_);
+
+		std::vector<int> class_offsets(C + 1, 0);
+		for (int i = 0; i < D; i++)
+			class_offsets[detection_class[i] + 1]++;
+		for (int c = 0; c < C; c++)
+			class_offsets[c + 1] += class_offsets[c];
+		std::vector<ScoredDetection> sorted(D);
+		std::vector<int> position(class_offsets.begin(), class_offsets.end() - 1);
+		for (int i = 0; i < D; i++){
+			int k = order[i];
+			sorted[position[detection_class[k]]++] = detections[k];
+		}
+
+		float sum = 0;
+		int counted = 0;
+		for (int c = 0; c < C; c++){
+			ClassResult& result = classes[c];
+			if (result.ground_truth_num == 0)
+				continue;
+			std::vector<ScoredDetection> class_detections(sorted.begin() + class_offsets[c], sorted.begin() + class_offsets[c + 1]);
+			result.average_precision = RecallPrecision(class_detections, result.ground_truth_num,
+				result.recall, result.precision, result.thresholds);
+			sum += result.average_precision;
+			counted++;
+		}
+		return counted > 0 ? sum / counted : 0;
+	}
+
+
+	void ThresholdDetectPositions(util::Span<cv::Rect> detect_positions,
+		util::Span<float> scores, float threshold,
 		std::vector<cv::Rect>& output_positions)
 	{
 		assert(detect_positions.size() == scores.size());
@@ -477,13 +1711,33 @@ namespace eval{
 	}
 
 
-	void Id2Positions(const std::vector<cv::Rect>& all_positions,
-		const std::vector<int>& position_id, std::vector<cv::Rect>& positions)
+	void ThresholdDetectPositions(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<float>& scores, float threshold,
+		util::FlatList<cv::Rect>& output_positions)
+	{
+		assert(detect_positions.size() == scores.size());
+		assert(detect_positions.data.size() == scores.data.size());
+
+		int test_num = detect_positions.size();
+		output_positions.clear();
+		output_positions.offsets.reserve(test_num + 1);
+		for (int i = 0; i < test_num; i++){
+			for (int j = detect_positions.offsets[i]; j < detect_positions.offsets[i + 1]; j++){
+				if (scores.data[j] > threshold)
+					output_positions.data.push_back(detect_positions.data[j]);
+			}
+			output_positions.offsets.push_back(output_positions.data.size());
+		}
+	}
+
+
+	void Id2Positions(util::Span<cv::Rect> all_positions,
+		util::Span<int> position_id, std::vector<cv::Rect>& positions)
 	{
 		positions.clear();
 
-		std::vector<int>::const_iterator it = position_id.begin(),
-			it_e = position_id.end();
+		const int* it = position_id.begin(),
+			*it_e = position_id.end();
 		while (it != it_e){
 			positions.push_back(all_positions[*it]);
 			it++;
@@ -501,4 +1755,12 @@ namespace eval{
 		}
 	}
 
+
+	void Id2Positions(const util::FlatList<cv::Rect>& all_positions,
+		const util::FlatList<int>& position_id, util::FlatList<cv::Rect>& positions)
+	{
+		assert(all_positions.size() == position_id.size());
+		util::gather(all_positions, position_id, positions);
+	}
+
 }
\ No newline at end of file
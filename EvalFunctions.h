@@ -35,12 +35,83 @@
 #define __EVAL_FUNCTIONS__
 
 #include <opencv2/core/core.hpp>
+#include "flatlist.hpp"
 
 namespace eval{
 
+	//! Number of threads used for per-image matching (1: serial, 0: all hardware threads)
+	void SetNumThreads(int num_threads);
+	int GetNumThreads();
+
+	//! Interpolation of the average precision returned by RecallPrecision() and the functions built on it
+	enum AveragePrecisionMode{
+		AP_11_POINT,	// PASCAL VOC 2007
+		AP_ALL_POINT	// PASCAL VOC 2010 and later
+	};
+	void SetAveragePrecisionMode(AveragePrecisionMode mode);
+	AveragePrecisionMode GetAveragePrecisionMode();
+
+	//! Overlap ratio of two rectangles, computed as in PASCAL VOC (0-1)
+	float calcRectOverlap(const cv::Rect& InputRect, const cv::Rect& CorrectRect);
+
+	//! Rectangles as separate coordinate arrays (structure of arrays) for calcRectOverlaps()
+	struct RectArray{
+		std::vector<int> left, top, right, bottom, area;
+
+		void assign(util::Span<cv::Rect> rects);
+		int size() const { return left.size(); }
+	};
+
+	//! Overlap ratios of one rectangle against all rectangles of rects (AVX2/SSE2 with scalar fallback)
+	/*!
+	The results are identical to calcRectOverlap(rect, rects[i]).
+	\param[out] overlaps buffer of rects.size() elements
+	*/
+	void calcRectOverlaps(const cv::Rect& rect, const RectArray& rects, float* overlaps);
+
+	//! Uniform grid over rectangles to find the ones another rectangle may overlap
+	/*!
+	query() returns a superset of the rectangles whose overlap with rect is not 0,
+	in ascending order of index. Rectangles without area are always returned.
+	*/
+	class RectGrid{
+	public:
+		void assign(util::Span<cv::Rect> rects);
+		void query(const cv::Rect& rect, std::vector<int>& candidates) const;
+
+	private:
+		int cell_index(long long pos, long long origin, long long cell_size, int cell_num) const;
+
+		long long left_, top_, cell_width_, cell_height_;
+		int cols_, rows_;
+		std::vector<int> cell_start_;	// items of cell c are cell_items_[cell_start_[c]..cell_start_[c + 1])
+		std::vector<int> cell_items_;
+		std::vector<int> always_;		// rectangles without area
+		int rect_num_;
+	};
+
 	// nK[@
 	void HangarianAlgorithm(const cv::Mat_<float>& cost, std::vector<int>& permutation);
 
+	//! Kuhn-Munkres (Hungarian) algorithm for a rectangular cost matrix, O(n^2 m)
+	/*!
+	\param[in] cost row-major cost matrix of rows x cols
+	\param[in] rows number of rows
+	\param[in] cols number of columns
+	\param[out] assignment column assigned to each row, -1 if the row is left unassigned (rows > cols)
+	\return total cost of the assignment
+	*/
+	float KuhnMunkres(const float* cost, int rows, int cols, std::vector<int>& assignment);
+
+	//! Bind detections of one image to its ground truth by optimal assignment
+	void bindRectPairs(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth,
+		std::vector<int>& binded_index, std::vector<float>& overlap_score);
+
+	//! Bind detections of one image to its ground truth greedily in descending order of score
+	void bindRectPairs(util::Span<cv::Rect> detect_positions, util::Span<cv::Rect> ground_truth,
+		util::Span<float> scores,
+		std::vector<int>& binded_index, std::vector<float>& overlap_score, float overlap_threshold = 0.5);
+
 	// oIuWFNgGround Truthf[^т
 	void bindRectPairs(const std::vector<std::vector<cv::Rect>>& detect_positions,
 		const std::vector<std::vector<cv::Rect>>& ground_truth,
@@ -58,6 +129,67 @@ namespace eval{
 		bindRectPairs(detect_positions, ground_truth, std::vector<std::vector<float>>(), binded_index, overlap_score, ground_truth_num);
 	};
 
+	//! bindRectPairs() over a flat data set
+	/*!
+	Same results as the nested version. binded_index and overlap_score take the shape
+	of detect_positions; an empty scores binds by optimal assignment.
+	*/
+	void bindRectPairs(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		util::FlatList<int>& binded_index,
+		util::FlatList<float>& overlap_score,
+		int* ground_truth_num, float overlap_threshold = 0.5);
+
+	//! binded_index of a detection that is neither a true positive nor a false positive
+	const int IGNORED_DETECTION = -2;
+
+	//! Ground truth left out of the evaluation (empty lists for none)
+	/*!
+	A detection not bound to other ground truth is ignored (IGNORED_DETECTION) if its
+	overlap with a difficult ground truth is above the overlap threshold, or an ignore
+	region covers more than the overlap threshold of its area (crowd regions). Difficult
+	ground truth is not counted in ground_truth_num.
+	*/
+	struct GroundTruthIgnore{
+		util::FlatList<char> difficult;		// flag of each ground truth
+		util::FlatList<cv::Rect> regions;	// ignore regions of each image
+
+		bool empty() const { return difficult.data.empty() && regions.data.empty(); }
+	};
+
+	//! bindRectPairs() over a flat data set with difficult ground truth and ignore regions
+	/*!
+	Ignored detections are found in the same pass over each image as the binding.
+	*/
+	void bindRectPairs(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		const GroundTruthIgnore& ignore,
+		util::FlatList<int>& binded_index,
+		util::FlatList<float>& overlap_score,
+		int* ground_truth_num, float overlap_threshold = 0.5);
+
+	//! Average precision at several overlap thresholds (e.g. 0.5:0.95 as COCO)
+	/*!
+	The overlap matrix of each image is computed once and the greedy binding of
+	bindRectPairs() is repeated on it for every threshold. A detection is a true
+	positive at a threshold if it is bound to a ground truth at that threshold.
+	\param[out] average_precisions average precision of each overlap threshold
+	\return mean of average_precisions
+	*/
+	float AveragePrecisionSweep(const std::vector<std::vector<cv::Rect>>& detect_positions,
+		const std::vector<std::vector<cv::Rect>>& ground_truth,
+		const std::vector<std::vector<float>>& scores,
+		const std::vector<float>& overlap_thresholds,
+		std::vector<float>& average_precisions);
+
+	float AveragePrecisionSweep(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<float>& scores,
+		const std::vector<float>& overlap_thresholds,
+		std::vector<float>& average_precisions);
+
 	/*
 	void bindRectPairs(const std::vector<std::vector<cv::Rect>>& detect_positions,
 		const std::vector<std::vector<cv::Rect>>& ground_truth,
@@ -81,6 +213,91 @@ namespace eval{
 			recall, precision, thresholds, overlap_threshold);
 	};
 
+	//! 11-point interpolated average precision (PASCAL VOC 2007)
+	float AveragePrecision(std::vector<float>& precision, std::vector<float>& recall);
+
+	//! All-point interpolated average precision (PASCAL VOC 2010 and later)
+	/*!
+	Area under the curve whose precision at each recall is the maximum precision at
+	that recall or higher. Points must be in the order of RecallPrecision() (recall
+	not increasing), so the interpolation and the area are taken in one pass.
+	*/
+	float AveragePrecisionAllPoint(const std::vector<float>& precision, const std::vector<float>& recall);
+
+	//! Thin out a recall-precision curve
+	/*!
+	A point is kept if its recall or precision differs by more than max_error from the
+	last kept point, so every dropped point is within max_error of a kept one. The first
+	and the last points are always kept. With max_points > 0, the error bound is raised
+	by bisection until at most max_points points remain.
+	*/
+	void DecimateCurve(std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds,
+		float max_error, int max_points = 0);
+
+	//! Score of a detection and whether it is a true positive
+	struct ScoredDetection{
+		float score;
+		bool true_positive;
+	};
+
+	//! Append (score, true positive) pairs of one image to detections (ignored detections are left out)
+	void CollectScoredDetections(util::Span<int> binded_idx,
+		util::Span<float> scores,
+		util::Span<float> overlap_score,
+		std::vector<ScoredDetection>& detections,
+		float overlap_threshold = 0.5);
+
+	//! Flatten bindRectPairs() results into (score, true positive) pairs
+	void CollectScoredDetections(const std::vector<std::vector<int>>& binded_idx,
+		const std::vector<std::vector<float>>& scores,
+		const std::vector<std::vector<float>>& overlap_score,
+		std::vector<ScoredDetection>& detections,
+		float overlap_threshold = 0.5);
+
+	void CollectScoredDetections(const util::FlatList<int>& binded_idx,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_score,
+		std::vector<ScoredDetection>& detections,
+		float overlap_threshold = 0.5);
+
+	//! Recall-precision curve by a single sweep over detections sorted by score (detections are sorted in place)
+	float RecallPrecision(std::vector<ScoredDetection>& detections, int ground_truth_num,
+		std::vector<float>& recall, std::vector<float>& precision, std::vector<float>& thresholds);
+
+	//! Sort added by score and merge it into sorted_detections, which stays in ascending order of score
+	void MergeScoredDetections(std::vector<ScoredDetection>& sorted_detections,
+		std::vector<ScoredDetection>& added);
+
+	//! Bootstrap distribution of the average precision over images
+	/*!
+	Images are resampled with replacement resample_num times. Each resample reuses the
+	results of bindRectPairs(): detections are sorted by score once, and a resample is
+	a sweep weighted by how many times each image was drawn, which gives the same AP as
+	RecallPrecision() on the resampled detections. Resamples run on GetNumThreads()
+	threads; resample k draws from its own generator seeded by (seed, k), so results
+	do not depend on the number of threads. Detections bound to IGNORED_DETECTION are left out.
+	\param[in] ground_truth ground truth of each image (only counted)
+	\param[out] average_precisions AP of each resample
+	\return mean of average_precisions
+	*/
+	float BootstrapAveragePrecision(const util::FlatList<int>& binded_idx,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_score,
+		const util::FlatList<cv::Rect>& ground_truth,
+		int resample_num, unsigned int seed,
+		std::vector<float>& average_precisions,
+		float overlap_threshold = 0.5);
+
+	//! Split detections of one image into true positives and false positives
+	void EvaluateDetection(util::Span<int> binded_index, util::Span<float> overlap_scores,
+		std::vector<int>& true_positive_id, std::vector<int>& false_positive_id, float overlap_threshold = 0.5);
+
+	//! Split detections of one image whose score is above threshold into true positives and false positives
+	void EvaluateDetection(util::Span<int> binded_index, util::Span<float> scores,
+		util::Span<float> overlap_scores,
+		std::vector<int>& true_positive_id, std::vector<int>& false_positive_id,
+		float threshold, float overlap_threshold = 0.5);
+
 	void EvaluateDetection(const std::vector<std::vector<int>>& binded_index,
 		const std::vector<std::vector<float>>& scores,
 		const std::vector<std::vector<float>>& overlap_scores,
@@ -98,6 +315,15 @@ namespace eval{
 			true_positive_id, false_positive_id, 0, overlap_threshold);
 	};
 
+	//! EvaluateDetection() over a flat data set (an empty scores ignores the score threshold)
+	void EvaluateDetection(const util::FlatList<int>& binded_index,
+		const util::FlatList<float>& scores,
+		const util::FlatList<float>& overlap_scores,
+		util::FlatList<int>& true_positive_id,
+		util::FlatList<int>& false_positive_id,
+		float threshold,
+		float overlap_threshold = 0.5);
+
 
 	void EvaluateAll(const std::vector<std::vector<cv::Rect>>& detect_positions,
 		const std::vector<std::vector<cv::Rect>>& ground_truth,
@@ -115,15 +341,61 @@ namespace eval{
 		float* average_precision,
 		float overlap_th = 0.5);
 
+	//! Result of one class of EvaluateAll() with class ids
+	struct ClassResult{
+		int label;
+		int ground_truth_num;
+		std::vector<float> recall, precision, thresholds;
+		float average_precision;
+	};
+
+	//! Evaluation of detections and ground truth with a class id on each rectangle
+	/*!
+	Rectangles are grouped by (image, class) and the groups are matched in parallel, so
+	a detection is bound only to ground truth of its class. The detections of all classes
+	are sorted by score once and split by class in that order for the recall-precision
+	curves. Classes are every label in detect_labels or ground_truth_labels in ascending
+	order; without scores, classes get no curve and an average precision of 0.
+	Ignore regions apply to detections of every class.
+	\param[out] true_positive_id, false_positive_id indices of detections in each image
+	\return mean of the average precisions of the classes with ground truth
+	*/
+	float EvaluateAll(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<int>& detect_labels,
+		const util::FlatList<cv::Rect>& ground_truth,
+		const util::FlatList<int>& ground_truth_labels,
+		const GroundTruthIgnore& ignore,
+		const util::FlatList<float>& scores,
+		float threshold,
+		util::FlatList<int>& true_positive_id,
+		util::FlatList<int>& false_positive_id,
+		std::vector<ClassResult>& classes,
+		float overlap_th = 0.5);
+
+
+	void ThresholdDetectPositions(util::Span<cv::Rect> detect_positions,
+		util::Span<float> scores, float threshold,
+		std::vector<cv::Rect>& output_positions);
 
 	void ThresholdDetectPositions(const std::vector<std::vector<cv::Rect>>& detect_positions,
 		const std::vector<std::vector<float>>& scores, float threshold,
 		std::vector<std::vector<cv::Rect>>& output_positions);
 
+	void ThresholdDetectPositions(const util::FlatList<cv::Rect>& detect_positions,
+		const util::FlatList<float>& scores, float threshold,
+		util::FlatList<cv::Rect>& output_positions);
+
+
+	void Id2Positions(util::Span<cv::Rect> all_positions,
+		util::Span<int> position_id, std::vector<cv::Rect>& positions);
 
 	void Id2Positions(const std::vector<std::vector<cv::Rect>>& all_positions, 
 		const std::vector<std::vector<int>>& position_id, std::vector<std::vector<cv::Rect>>& positions);
 
+	//! Id2Positions() over a flat data set; positions takes the shape of position_id
+	void Id2Positions(const util::FlatList<cv::Rect>& all_positions,
+		const util::FlatList<int>& position_id, util::FlatList<cv::Rect>& positions);
+
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,299 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                           License Agreement
+//
+// Copyright (C) 2014 Takuya MINAGAWA.
+// Third party copyrights are property of their respective owners.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//M*/
+
+// Tests of eval:: routines against naive references, run by main() in debug builds
+
+#ifdef _DEBUG
+
+#include "EvalFunctions.h"
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+
+namespace{
+
+	// random detections of N images: binding, overlap and a score from a few values,
+	// negative and zero included so that the curve has ties and the first threshold is not the lowest
+	void RandomDetections(int N, unsigned int seed, std::vector<std::vector<int>>& binded_idx,
+		std::vector<std::vector<float>>& scores, std::vector<std::vector<float>>& overlap_score)
+	{
+		static const float values[] = { -2.5f, -2.0f, -1.0f, -0.25f, 0.0f, 0.25f, 0.75f, 1.5f };
+		std::mt19937 rng(seed);
+		binded_idx.assign(N, std::vector<int>());
+		scores.assign(N, std::vector<float>());
+		overlap_score.assign(N, std::vector<float>());
+		for (int n = 0; n < N; n++){
+			int D = rng() % 6;
+			for (int d = 0; d < D; d++){
+				binded_idx[n].push_back((int)(rng() % 4) - 1);
+				scores[n].push_back(values[rng() % 8]);
+				overlap_score[n].push_back((rng() % 100) / 100.0f);
+			}
+		}
+	}
+
+
+	// minimum total cost over all assignments of min(rows, cols) pairs
+	float BruteForceAssignment(const std::vector<float>& cost, int rows, int cols, int row, std::vector<bool>& used, int left)
+	{
+		if (row == rows)
+			return 0;
+		float best = 1e30f;
+		if (rows - row > left)
+			best = BruteForceAssignment(cost, rows, cols, row + 1, used, left);	// row left unassigned
+		if (left > 0){
+			for (int c = 0; c < cols; c++){
+				if (used[c])
+					continue;
+				used[c] = true;
+				best = std::min(best, cost[row * cols + c] + BruteForceAssignment(cost, rows, cols, row + 1, used, left - 1));
+				used[c] = false;
+			}
+		}
+		return best;
+	}
+
+
+	std::vector<cv::Rect> RandomRects(int num, int range, unsigned int seed)
+	{
+		std::mt19937 rng(seed);
+		std::vector<cv::Rect> rects;
+		for (int i = 0; i < num; i++){
+			int x = rng() % range, y = rng() % range;
+			int w = rng() % (range / 2), h = rng() % (range / 2);
+			rects.push_back(cv::Rect(x, y, w, h));
+		}
+		return rects;
+	}
+
+}
+
+
+TEST(RecallPrecisionTest, SweepEqualsEvaluateDetectionAtEachThreshold)
+{
+	for (unsigned int seed = 1; seed <= 20; seed++){
+		std::vector<std::vector<int>> binded_idx;
+		std::vector<std::vector<float>> scores, overlap_score;
+		RandomDetections(30, seed, binded_idx, scores, overlap_score);
+		int ground_truth_num = 40;
+
+		std::vector<float> recall, precision, thresholds;
+		eval::RecallPrecision(binded_idx, scores, overlap_score, ground_truth_num, recall, precision, thresholds);
+
+		// thresholds are the midpoints between unique scores, starting from (lowest + 0) / 2
+		std::vector<float> score_list;
+		for (int n = 0; n < scores.size(); n++)
+			score_list.insert(score_list.end(), scores[n].begin(), scores[n].end());
+		std::sort(score_list.begin(), score_list.end());
+		std::vector<float> expected_thresholds;
+		float prev = 0;
+		for (int i = 0; i < score_list.size(); i++){
+			if (score_list[i] == prev)
+				continue;
+			expected_thresholds.push_back((score_list[i] + prev) / 2);
+			prev = score_list[i];
+		}
+		ASSERT_EQ(expected_thresholds, thresholds) << "seed " << seed;
+
+		for (int t = 0; t < thresholds.size(); t++){
+			std::vector<std::vector<int>> true_positive_id, false_positive_id;
+			eval::EvaluateDetection(binded_idx, scores, overlap_score, true_positive_id, false_positive_id, thresholds[t]);
+			int true_positive_num = 0, false_positive_num = 0;
+			for (int n = 0; n < binded_idx.size(); n++){
+				true_positive_num += true_positive_id[n].size();
+				false_positive_num += false_positive_id[n].size();
+			}
+			EXPECT_EQ((float)true_positive_num / ground_truth_num, recall[t]) << "seed " << seed << " threshold " << thresholds[t];
+			EXPECT_EQ((float)true_positive_num / (true_positive_num + false_positive_num), precision[t])
+				<< "seed " << seed << " threshold " << thresholds[t];
+		}
+	}
+}
+
+
+TEST(KuhnMunkresTest, EqualsBruteForceOptimum)
+{
+	std::mt19937 rng(3);
+	for (int rows = 1; rows <= 5; rows++){
+		for (int cols = 1; cols <= 5; cols++){
+			for (int trial = 0; trial < 20; trial++){
+				std::vector<float> cost(rows * cols);
+				for (int i = 0; i < cost.size(); i++)
+					cost[i] = (rng() % 1000) / 1000.0f;
+
+				std::vector<int> assignment;
+				float total = eval::KuhnMunkres(&cost[0], rows, cols, assignment);
+				std::vector<bool> used(cols, false);
+				float best = BruteForceAssignment(cost, rows, cols, 0, used, std::min(rows, cols));
+				EXPECT_NEAR(best, total, 1e-4) << rows << "x" << cols << " trial " << trial;
+
+				// the assignment is a matching of min(rows, cols) pairs with the returned cost
+				ASSERT_EQ(rows, assignment.size());
+				std::vector<bool> taken(cols, false);
+				int pairs = 0;
+				float sum = 0;
+				for (int r = 0; r < rows; r++){
+					int c = assignment[r];
+					if (c < 0)
+						continue;
+					ASSERT_LT(c, cols);
+					EXPECT_FALSE(taken[c]);
+					taken[c] = true;
+					pairs++;
+					sum += cost[r * cols + c];
+				}
+				EXPECT_EQ(std::min(rows, cols), pairs);
+				EXPECT_NEAR(total, sum, 1e-4);
+			}
+		}
+	}
+}
+
+
+TEST(RectOverlapTest, OverlapsEqualPairwiseOverlap)
+{
+	std::vector<cv::Rect> rects = RandomRects(200, 40, 5);
+	// touching, identical, nested and degenerate rectangles
+	rects.push_back(cv::Rect(10, 10, 10, 10));
+	rects.push_back(cv::Rect(20, 10, 10, 10));
+	rects.push_back(cv::Rect(10, 20, 10, 10));
+	rects.push_back(cv::Rect(10, 10, 10, 10));
+	rects.push_back(cv::Rect(12, 12, 4, 4));
+	rects.push_back(cv::Rect(15, 15, 0, 0));
+	rects.push_back(cv::Rect(15, 15, 0, 5));
+	rects.push_back(cv::Rect(15, 15, 5, 0));
+	rects.push_back(cv::Rect(-5, -5, 3, 3));
+
+	eval::RectArray rect_array;
+	rect_array.assign(rects);
+	std::vector<float> overlaps(rects.size());
+	for (int i = 0; i < rects.size(); i++){
+		eval::calcRectOverlaps(rects[i], rect_array, &overlaps[0]);
+		for (int j = 0; j < rects.size(); j++){
+			// degenerate pairs give 0 / 0 in both
+			float expected = eval::calcRectOverlap(rects[i], rects[j]);
+			EXPECT_TRUE(expected == overlaps[j] || (expected != expected && overlaps[j] != overlaps[j]))
+				<< i << " " << j << ": " << expected << " vs " << overlaps[j];
+		}
+	}
+}
+
+
+TEST(RectGridTest, QueryCoversLinearScan)
+{
+	for (unsigned int seed = 1; seed <= 5; seed++){
+		std::vector<cv::Rect> rects = RandomRects(300, 200, seed);
+		rects.push_back(cv::Rect(50, 50, 0, 0));
+		rects.push_back(cv::Rect(0, 0, 200, 200));
+		std::vector<cv::Rect> queries = RandomRects(100, 220, seed + 100);
+		queries.push_back(cv::Rect(-50, -50, 10, 10));
+		queries.push_back(cv::Rect(60, 60, 0, 0));
+
+		eval::RectGrid grid;
+		grid.assign(rects);
+		std::vector<int> candidates;
+		for (int q = 0; q < queries.size(); q++){
+			grid.query(queries[q], candidates);
+			EXPECT_TRUE(std::adjacent_find(candidates.begin(), candidates.end(), std::greater_equal<int>()) == candidates.end())
+				<< "candidates are not in ascending order";
+			for (int i = 0; i < rects.size(); i++){
+				bool must = eval::calcRectOverlap(queries[q], rects[i]) != 0 || rects[i].area() == 0;
+				if (must){
+					EXPECT_TRUE(std::binary_search(candidates.begin(), candidates.end(), i))
+						<< "seed " << seed << " query " << q << " misses " << i;
+				}
+			}
+		}
+	}
+}
+
+
+TEST(BootstrapTest, EqualsRecomputedResamples)
+{
+	// detections with negative scores and some of them ignored
+	std::vector<std::vector<int>> nested_binded;
+	std::vector<std::vector<float>> nested_scores, nested_overlap;
+	RandomDetections(60, 9, nested_binded, nested_scores, nested_overlap);
+	for (int n = 0; n < nested_binded.size(); n++){
+		for (int i = 0; i < nested_binded[n].size(); i++){
+			if ((n + i) % 7 == 0)
+				nested_binded[n][i] = eval::IGNORED_DETECTION;
+		}
+	}
+	util::FlatList<int> binded_idx;
+	util::FlatList<float> scores, overlap_score;
+	binded_idx.assign(nested_binded);
+	scores.assign(nested_scores);
+	overlap_score.assign(nested_overlap);
+	util::FlatList<cv::Rect> ground_truth;
+	for (int n = 0; n < binded_idx.size(); n++)
+		ground_truth.push_back(std::vector<cv::Rect>(n % 3, cv::Rect(0, 0, 1, 1)));
+
+	const int resample_num = 50;
+	const unsigned int seed = 7;
+	int num_threads = eval::GetNumThreads();
+	std::vector<float> average_precisions, threaded_average_precisions;
+	eval::SetNumThreads(1);
+	eval::BootstrapAveragePrecision(binded_idx, scores, overlap_score, ground_truth, resample_num, seed, average_precisions);
+	eval::SetNumThreads(3);
+	eval::BootstrapAveragePrecision(binded_idx, scores, overlap_score, ground_truth, resample_num, seed, threaded_average_precisions);
+	eval::SetNumThreads(num_threads);
+	EXPECT_EQ(average_precisions, threaded_average_precisions);
+
+	// draw the images of each resample as BootstrapAveragePrecision() does and evaluate the copies
+	int N = binded_idx.size();
+	ASSERT_EQ(resample_num, average_precisions.size());
+	for (int k = 0; k < resample_num; k++){
+		std::seed_seq seq = { seed, (unsigned int)k };
+		std::mt19937 rng(seq);
+		std::uniform_int_distribution<int> draw(0, N - 1);
+		std::vector<int> weight(N, 0);
+		for (int n = 0; n < N; n++)
+			weight[draw(rng)]++;
+
+		std::vector<eval::ScoredDetection> detections;
+		int ground_truth_num = 0;
+		for (int n = 0; n < N; n++){
+			for (int w = 0; w < weight[n]; w++){
+				eval::CollectScoredDetections(binded_idx[n], scores[n], overlap_score[n], detections);
+				ground_truth_num += ground_truth.count(n);
+			}
+		}
+		std::vector<float> recall, precision, thresholds;
+		float ap = eval::RecallPrecision(detections, ground_truth_num, recall, precision, thresholds);
+		EXPECT_EQ(ap, average_precisions[k]) << "resample " << k;
+	}
+}
+
+#endif
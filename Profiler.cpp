@@ -0,0 +1,136 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                           License Agreement
+//
+// Copyright (C) 2014 Takuya MINAGAWA.
+// Third party copyrights are property of their respective owners.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//M*/
+
+#include "Profiler.h"
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+namespace util{
+
+	namespace profile_detail{
+		bool enabled = false;
+		std::atomic<long long> counters[PROFILE_COUNTER_NUM];
+
+		struct Stage{
+			const char* name;
+			long long calls;
+			double milliseconds;
+		};
+
+		static std::mutex stage_mutex;
+		static std::vector<Stage> stages;	// in order of first call
+		static std::chrono::high_resolution_clock::time_point start;
+
+		void AddStageTime(const char* stage, double milliseconds)
+		{
+			std::lock_guard<std::mutex> lock(stage_mutex);
+			for (int i = 0; i < stages.size(); i++){
+				if (stages[i].name == stage || std::string(stages[i].name) == stage){
+					stages[i].calls++;
+					stages[i].milliseconds += milliseconds;
+					return;
+				}
+			}
+			Stage s = { stage, 1, milliseconds };
+			stages.push_back(s);
+		}
+	}
+
+
+	static const char* counter_names[PROFILE_COUNTER_NUM] = {
+		"overlaps", "assignments", "thresholds", "bytes_parsed", "images_drawn"
+	};
+
+
+	void EnableProfile(bool enable)
+	{
+		using namespace profile_detail;
+		if (enable && !enabled){
+			std::lock_guard<std::mutex> lock(stage_mutex);
+			stages.clear();
+			for (int i = 0; i < PROFILE_COUNTER_NUM; i++)
+				counters[i] = 0;
+			start = std::chrono::high_resolution_clock::now();
+		}
+		enabled = enable;
+	}
+
+
+	bool SaveProfile(const std::string& profile_file)
+	{
+		using namespace profile_detail;
+
+		std::ofstream ofs(profile_file);
+		if (!ofs.is_open()){
+			std::cerr << "Error: Fail to save profile in " << profile_file << std::endl;
+			return false;
+		}
+
+		std::chrono::duration<double, std::milli> total = std::chrono::high_resolution_clock::now() - start;
+		std::lock_guard<std::mutex> lock(stage_mutex);
+		bool json = profile_file.size() >= 5 && profile_file.compare(profile_file.size() - 5, 5, ".json") == 0;
+		if (json){
+			ofs << "{" << std::endl;
+			ofs << "  \"total_milliseconds\": " << total.count() << "," << std::endl;
+			ofs << "  \"stages\": [";
+			for (int i = 0; i < stages.size(); i++){
+				ofs << (i > 0 ? "," : "") << std::endl;
+				ofs << "    {\"name\": \"" << stages[i].name << "\", \"calls\": " << stages[i].calls
+					<< ", \"milliseconds\": " << stages[i].milliseconds << "}";
+			}
+			ofs << std::endl << "  ]," << std::endl;
+			ofs << "  \"counters\": {";
+			for (int i = 0; i < PROFILE_COUNTER_NUM; i++){
+				ofs << (i > 0 ? "," : "") << std::endl;
+				ofs << "    \"" << counter_names[i] << "\": " << counters[i].load();
+			}
+			ofs << std::endl << "  }" << std::endl << "}" << std::endl;
+		}
+		else{
+			ofs << "kind,name,count,milliseconds" << std::endl;
+			ofs << "total,total,1," << total.count() << std::endl;
+			for (int i = 0; i < stages.size(); i++){
+				ofs << "stage," << stages[i].name << "," << stages[i].calls << "," << stages[i].milliseconds << std::endl;
+			}
+			for (int i = 0; i < PROFILE_COUNTER_NUM; i++){
+				ofs << "counter," << counter_names[i] << "," << counters[i].load() << "," << std::endl;
+			}
+		}
+
+		std::cout << "Save profile in " << profile_file << std::endl;
+		return ofs.good();
+	}
+
+}
@@ -0,0 +1,83 @@
+#ifndef __PROFILER__
+#define __PROFILER__
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+namespace util{
+
+	//! Counters reported by SaveProfile()
+	enum ProfileCounter{
+		COUNT_OVERLAPS,			// overlaps of detection and ground truth computed
+		COUNT_ASSIGNMENTS,		// detections bound to ground truth
+		COUNT_THRESHOLDS,		// score thresholds swept for recall-precision curves
+		COUNT_BYTES_PARSED,		// bytes of annotation and score files read
+		COUNT_IMAGES_DRAWN,		// result images saved
+		PROFILE_COUNTER_NUM
+	};
+
+	namespace profile_detail{
+		extern bool enabled;
+		extern std::atomic<long long> counters[PROFILE_COUNTER_NUM];
+		void AddStageTime(const char* stage, double milliseconds);
+	}
+
+	//! Start collecting stage times and counters
+	/*!
+	Call before evaluation starts. While profiling is off, timers and counters
+	cost one branch on a global flag.
+	*/
+	void EnableProfile(bool enable);
+
+	inline bool IsProfileEnabled()
+	{
+		return profile_detail::enabled;
+	}
+
+	//! Add n to a counter when profiling is on (thread safe)
+	inline void ProfileCount(ProfileCounter counter, long long n = 1)
+	{
+		if (profile_detail::enabled)
+			profile_detail::counters[counter].fetch_add(n, std::memory_order_relaxed);
+	}
+
+	//! Add the time until the end of the scope to a stage
+	/*!
+	stage must be a string literal. Stages are meant to be coarse (a whole load or
+	a whole matching pass), not per rectangle.
+	*/
+	class ScopedTimer{
+	public:
+		explicit ScopedTimer(const char* stage) : stage_(profile_detail::enabled ? stage : 0)
+		{
+			if (stage_)
+				start_ = std::chrono::high_resolution_clock::now();
+		}
+
+		~ScopedTimer()
+		{
+			if (stage_){
+				std::chrono::duration<double, std::milli> elapsed = std::chrono::high_resolution_clock::now() - start_;
+				profile_detail::AddStageTime(stage_, elapsed.count());
+			}
+		}
+
+	private:
+		ScopedTimer(const ScopedTimer&);
+		ScopedTimer& operator=(const ScopedTimer&);
+
+		const char* stage_;
+		std::chrono::high_resolution_clock::time_point start_;
+	};
+
+	//! Save stage times and counters
+	/*!
+	JSON if the file name ends with ".json", otherwise CSV (kind,name,count,milliseconds).
+	\return true on success
+	*/
+	bool SaveProfile(const std::string& profile_file);
+
+}
+
+#endif
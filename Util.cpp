@@ -32,18 +32,26 @@
 //M*/
 
 #include "Util.h"
+#include "Profiler.h"
+#include "parallel.hpp"
 #include <fstream>
 #include <boost/filesystem/operations.hpp>
 #include <boost/filesystem/path.hpp>
 #include <opencv2/imgproc/imgproc.hpp>
 #include <iostream>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <unordered_map>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 
 namespace util{
 
 	//! Ame[Vt@C̓ǂݍ
 	/*!
 	opencv_createsamles.exeƓ`̃Ame[Vt@Cǂݏ
-	ReadCsvFile()֐K{
 	\param[in] gt_file Ame[Vt@C
 	\param[out] imgpathlist 摜t@Cւ̃pX
 	\param[out] rectlist e摜ɂꂽAme[ṼXg
@@ -51,36 +59,15 @@ namespace util{
 	*/
 	bool LoadAnnotationFile(const std::string& gt_file, std::vector<std::string>& imgpathlist, std::vector<std::vector<cv::Rect>>& rectlist)
 	{
-		std::vector<std::vector<std::string>> tokenized_strings;
-		std::vector<std::string> sep;
-		sep.push_back(" ");
-		if (!ReadCSVFile(gt_file, tokenized_strings, sep))
+		AnnotationList annotations;
+		if (!LoadAnnotationFile(gt_file, annotations))
 			return false;
 
-		std::vector<std::vector<std::string>>::iterator it, it_end = tokenized_strings.end();
-		for (it = tokenized_strings.begin(); it != it_end; it++){
-			int num_str = it->size();
-			if (num_str < 2)
-				continue;
-
-			std::string filename = (*it)[0];
-			if (filename.empty() || filename.find("#") != std::string::npos){
-				continue;
-			}
-
-			imgpathlist.push_back(filename);
-			int obj_num = atoi((*it)[1].c_str());
-			std::vector<cv::Rect> rects;
-			for (int i = 0; i<obj_num && 4 * i + 6 <= num_str; i++){
-				int j = 4 * i + 2;
-				cv::Rect obj_rect;
-				obj_rect.x = atoi((*it)[j].c_str());
-				obj_rect.y = atoi((*it)[j + 1].c_str());
-				obj_rect.width = atoi((*it)[j + 2].c_str());
-				obj_rect.height = atoi((*it)[j + 3].c_str());
-				rects.push_back(obj_rect);
-			}
-			rectlist.push_back(rects);
+		int N = annotations.size();
+		imgpathlist.insert(imgpathlist.end(), annotations.imgpathlist.begin(), annotations.imgpathlist.end());
+		for (int n = 0; n < N; n++){
+			rectlist.push_back(std::vector<cv::Rect>(annotations.rects.begin() + annotations.offsets[n],
+				annotations.rects.begin() + annotations.offsets[n + 1]));
 		}
 
 		return true;
@@ -97,21 +84,226 @@ namespace util{
 	*/
 	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files, const std::vector<std::vector<cv::Rect>>& obj_rects, const std::string& sep)
 	{
+		ScopedTimer timer("SaveAnnotationFile");
 		assert(img_files.size() == obj_rects.size());
 
-		std::ofstream ofs(anno_file);
-		if (!ofs.is_open())
+		TextWriter writer;
+		if (!writer.open(anno_file))
 			return false;
 
 		int num = img_files.size();
 		for (int i = 0; i<num; i++){
-			ofs << img_files[i] << sep << obj_rects[i].size();
-			for (int j = 0; j<obj_rects[i].size(); j++){
-				cv::Rect rect = obj_rects[i][j];
-				ofs << sep << rect.x << sep << rect.y << sep << rect.width << sep << rect.height;
+			WriteAnnotationLine(writer, img_files[i], obj_rects[i], sep);
+		}
+
+		return writer.close();
+	}
+
+
+	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files, const FlatList<cv::Rect>& obj_rects,
+		const std::string& sep, int num_threads)
+	{
+		return SaveAnnotationFile(anno_file, img_files, obj_rects, FlatList<int>(), sep, num_threads);
+	}
+
+
+	void WriteAnnotationLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> rects, const std::string& sep)
+	{
+		WriteAnnotationLine(writer, img_file, rects, Span<int>(), sep);
+	}
+
+
+	void WriteAnnotationLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> rects, Span<int> labels,
+		const std::string& sep)
+	{
+		assert(labels.empty() || labels.size() == rects.size());
+		writer << img_file << sep << rects.size();
+		for (int j = 0; j<rects.size(); j++){
+			cv::Rect rect = rects[j];
+			writer << sep << rect.x << sep << rect.y << sep << rect.width << sep << rect.height;
+			if (!labels.empty())
+				writer << sep << labels[j];
+		}
+		writer << '\n';
+	}
+
+
+	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files,
+		const FlatList<cv::Rect>& obj_rects, const FlatList<int>& labels, const std::string& sep, int num_threads)
+	{
+		ScopedTimer timer("SaveAnnotationFile");
+		assert(img_files.size() == obj_rects.size());
+		assert(labels.data.empty() || labels.offsets == obj_rects.offsets);
+
+		TextWriter writer;
+		if (!writer.open(anno_file))
+			return false;
+
+		write_rows(writer, img_files.size(), [&](TextWriter& rows, int i){
+			WriteAnnotationLine(rows, img_files[i], obj_rects[i], labels.data.empty() ? Span<int>() : labels[i], sep);
+		}, num_threads);
+
+		return writer.close();
+	}
+
+
+	bool SaveScoreFile(const std::string& score_file, const std::vector<std::vector<float>>& scores)
+	{
+		ScopedTimer timer("SaveScoreFile");
+		TextWriter writer;
+		if (!writer.open(score_file))
+			return false;
+
+		int num = scores.size();
+		for (int i = 0; i < num; i++){
+			writer << (int)scores[i].size();
+			for (int j = 0; j < scores[i].size(); j++){
+				writer << ' ' << scores[i][j];
 			}
-			ofs << std::endl;
+			writer << '\n';
+		}
+
+		return writer.close();
+	}
+
+
+	void WriteSummaryHeader(TextWriter& writer)
+	{
+		writer << "file name,true positive,false positive,miss detect\n";
+	}
+
+
+	void WriteSummaryLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> ground_truth,
+		Span<cv::Rect> true_positives, Span<cv::Rect> false_positives)
+	{
+		writer << img_file << ',' << true_positives.size() << ','
+			<< false_positives.size() << ','
+			<< ground_truth.size() - true_positives.size() << '\n';
+	}
+
+
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files,
+		const std::vector<std::vector<cv::Rect>>& ground_truth,
+		const std::vector<std::vector<cv::Rect>>& true_positives,
+		const std::vector<std::vector<cv::Rect>>& false_positives)
+	{
+		ScopedTimer timer("SaveSummary");
+		assert(img_files.size() == ground_truth.size());
+		assert(img_files.size() == true_positives.size());
+		assert(false_positives.size() == true_positives.size());
+
+		TextWriter writer;
+		if (!writer.open(output_file))
+			return false;
+
+		WriteSummaryHeader(writer);
+		int num_plot = img_files.size();
+		for (int i = 0; i < num_plot; i++){
+			WriteSummaryLine(writer, img_files[i], ground_truth[i], true_positives[i], false_positives[i]);
+		}
+		if (!writer.close())
+			return false;
+		std::cout << "Save summary file in " << output_file << " as CSV." << std::endl;
+
+		return true;
+	}
+
+
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files,
+		const FlatList<cv::Rect>& ground_truth,
+		const FlatList<cv::Rect>& true_positives,
+		const FlatList<cv::Rect>& false_positives,
+		int num_threads)
+	{
+		ScopedTimer timer("SaveSummary");
+		assert(img_files.size() == ground_truth.size());
+		assert(img_files.size() == true_positives.size());
+		assert(false_positives.size() == true_positives.size());
+
+		TextWriter writer;
+		if (!writer.open(output_file))
+			return false;
+
+		WriteSummaryHeader(writer);
+		write_rows(writer, img_files.size(), [&](TextWriter& rows, int i){
+			WriteSummaryLine(rows, img_files[i], ground_truth[i], true_positives[i], false_positives[i]);
+		}, num_threads);
+		if (!writer.close())
+			return false;
+		std::cout << "Save summary file in " << output_file << " as CSV." << std::endl;
+
+		return true;
+	}
+
+
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files, const std::vector<int>& counts)
+	{
+		ScopedTimer timer("SaveSummary");
+		assert(counts.size() == img_files.size() * 3);
+
+		TextWriter writer;
+		if (!writer.open(output_file))
+			return false;
+
+		WriteSummaryHeader(writer);
+		int num_plot = img_files.size();
+		for (int i = 0; i < num_plot; i++){
+			writer << img_files[i] << ',' << counts[3 * i] << ',' << counts[3 * i + 1] << ',' << counts[3 * i + 2] << '\n';
+		}
+		if (!writer.close())
+			return false;
+		std::cout << "Save summary file in " << output_file << " as CSV." << std::endl;
+
+		return true;
+	}
+
+
+	bool SaveRecallPrecisionCurve(const std::string& output_file, 
+		const std::vector<float>& recall, const std::vector<float>& precision, const std::vector<float>& thresholds,
+		int num_threads)
+	{
+		ScopedTimer timer("SaveRecallPrecisionCurve");
+		assert(recall.size() == precision.size());
+		assert(recall.size() == thresholds.size());
+
+		TextWriter writer;
+		if (!writer.open(output_file))
+			return false;
+
+		writer << "threshold,recall,precision\n";
+		write_rows(writer, recall.size(), [&](TextWriter& rows, int i){
+			rows << thresholds[i] << ',' << recall[i] << ',' << precision[i] << '\n';
+		}, num_threads);
+		if (!writer.close())
+			return false;
+		std::cout << "Save rp-curve in " << output_file << " as CSV: in order threshold, recall, and precision." << std::endl;
+
+		return true;
+	}
+
+
+	bool SaveAveragePrecisions(const std::string& output_file,
+		const std::vector<float>& overlap_ths, const std::vector<float>& average_precisions, float mean_ap)
+	{
+		ScopedTimer timer("SaveAveragePrecisions");
+		assert(overlap_ths.size() == average_precisions.size());
+
+		TextWriter writer;
+		if (!writer.open(output_file))
+			return false;
+
+		writer << "overlap threshold,average precision\n";
+		int num_plot = overlap_ths.size();
+		for (int i = 0; i < num_plot; i++){
+			writer << overlap_ths[i] << ',' << average_precisions[i] << '\n';
 		}
+		writer << "mean," << mean_ap << '\n';
+		if (!writer.close())
+			return false;
+		std::cout << "Save average precisions in " << output_file << " as CSV." << std::endl;
 
 		return true;
 	}
@@ -120,37 +312,1313 @@ namespace util{
 	//! XRAt@C̓ǂݍ
 	bool LoadScoreFile(const std::string& score_file, std::vector<std::vector<float>>& scores)
 	{
-		std::vector<std::vector<std::string>> tokenized_strings;
-		std::vector<std::string> sep;
-		sep.push_back(" ");
-		if (!ReadCSVFile(score_file, tokenized_strings, sep))
+		ScoreList score_list;
+		if (!LoadScoreFile(score_file, score_list))
+			return false;
+
+		int N = score_list.size();
+		for (int n = 0; n < N; n++){
+			scores.push_back(std::vector<float>(score_list.scores.begin() + score_list.offsets[n],
+				score_list.scores.begin() + score_list.offsets[n + 1]));
+		}
+
+		return true;
+	}
+
+
+	struct MappedFile::Impl{
+		boost::interprocess::file_mapping file;
+		boost::interprocess::mapped_region region;
+	};
+
+
+	bool MappedFile::open(const std::string& filename)
+	{
+		close();
+		try{
+			std::shared_ptr<Impl> impl = std::make_shared<Impl>();
+			impl->file = boost::interprocess::file_mapping(filename.c_str(), boost::interprocess::read_only);
+			if (boost::filesystem::file_size(filename) > 0){
+				impl->region = boost::interprocess::mapped_region(impl->file, boost::interprocess::read_only);
+				data_ = static_cast<const char*>(impl->region.get_address());
+				size_ = impl->region.get_size();
+			}
+			impl_ = impl;
+		}
+		catch (std::exception&){
+			close();
+			return false;
+		}
+		return true;
+	}
+
+
+	void MappedFile::close()
+	{
+		impl_.reset();
+		data_ = 0;
+		size_ = 0;
+	}
+
+
+	// A token is a range of characters between single spaces, same as TokenizeString() with " "
+	struct Token{
+		const char* begin;
+		const char* end;
+	};
+
+
+	// Cut the next line from [ptr, end) like std::getline() on a text mode stream (CR before LF is dropped)
+	static const char* NextLine(const char* ptr, const char* end, const char** line_end)
+	{
+		const char* eol = static_cast<const char*>(memchr(ptr, '\n', end - ptr));
+		const char* next = eol ? eol + 1 : end;
+		if (!eol)
+			eol = end;
+		if (eol > ptr && eol[-1] == '\r')
+			eol--;
+		*line_end = eol;
+		return next;
+	}
+
+
+	static void SplitLine(const char* begin, const char* end, std::vector<Token>& tokens)
+	{
+		tokens.clear();
+		Token token;
+		token.begin = begin;
+		while (true){
+			const char* sep = static_cast<const char*>(memchr(token.begin, ' ', end - token.begin));
+			token.end = sep ? sep : end;
+			tokens.push_back(token);
+			if (!sep)
+				break;
+			token.begin = sep + 1;
+		}
+	}
+
+
+	static bool HasComment(const Token& token)
+	{
+		return token.begin == token.end || memchr(token.begin, '#', token.end - token.begin) != 0;
+	}
+
+
+	// same result as atoi() without copying the token
+	static int ParseInt(const Token& token)
+	{
+		const char* p = token.begin;
+		while (p < token.end && isspace((unsigned char)*p))
+			p++;
+		bool negative = false;
+		if (p < token.end && (*p == '-' || *p == '+')){
+			negative = (*p == '-');
+			p++;
+		}
+		int value = 0;
+		for (; p < token.end && *p >= '0' && *p <= '9'; p++){
+			value = value * 10 + (*p - '0');
+		}
+		return negative ? -value : value;
+	}
+
+
+	// same result as atof(), the token is copied to the stack since strtod() needs a terminated string
+	static double ParseDouble(const Token& token)
+	{
+		char buf[64];
+		size_t len = token.end - token.begin;
+		if (len < sizeof(buf)){
+			memcpy(buf, token.begin, len);
+			buf[len] = '\0';
+			return atof(buf);
+		}
+		return atof(std::string(token.begin, token.end).c_str());
+	}
+
+
+	// true if the token is an integer with an optional sign and nothing else
+	static bool IsInteger(const Token& token)
+	{
+		const char* p = token.begin;
+		if (p < token.end && (*p == '-' || *p == '+'))
+			p++;
+		if (p == token.end)
+			return false;
+		for (; p < token.end; p++){
+			if (*p < '0' || *p > '9')
+				return false;
+		}
+		return true;
+	}
+
+
+	// true if the line has a class id after each object: one more field per object,
+	// no empty token (a trailing space of a legacy line is not a class id) and integer class ids
+	static bool HasClassIds(const std::vector<Token>& tokens, int obj_num, int fields)
+	{
+		if (obj_num <= 0 || tokens.size() != (size_t)(fields + 1) * obj_num + 2)
+			return false;
+		for (int i = 0; i < tokens.size(); i++){
+			if (tokens[i].begin == tokens[i].end)
+				return false;
+		}
+		for (int i = 0; i < obj_num; i++){
+			if (!IsInteger(tokens[(fields + 1) * i + fields + 2]))
+				return false;
+		}
+		return true;
+	}
+
+
+	// Parse a tokenized line of an annotation file, rectangles are appended to rects
+	// and class ids to labels if the line has them ("x y w h class" for each object).
+	// With scores, a score follows each rectangle ("x y w h score [class]").
+	// \return false if the line is a comment or has no object number
+	static bool ParseAnnotationTokens(const std::vector<Token>& tokens, std::string& imgpath, std::vector<cv::Rect>& rects,
+		std::vector<int>& labels, bool* labeled, std::vector<float>* scores = 0)
+	{
+		int num_str = tokens.size();
+		*labeled = false;
+		if (num_str < 2)
+			return false;
+		if (HasComment(tokens[0]))
 			return false;
 
-		std::vector<std::vector<std::string>>::iterator it, it_end = tokenized_strings.end();
-		for (it = tokenized_strings.begin(); it != it_end; it++){
-			int num_str = it->size();
-			if (num_str < 1)
+		imgpath.assign(tokens[0].begin, tokens[0].end);
+		int obj_num = ParseInt(tokens[1]);
+		int fields = scores ? 5 : 4;
+		*labeled = HasClassIds(tokens, obj_num, fields);
+		int stride = *labeled ? fields + 1 : fields;
+		for (int i = 0; i<obj_num && stride * i + stride + 2 <= num_str; i++){
+			int j = stride * i + 2;
+			rects.push_back(cv::Rect(ParseInt(tokens[j]), ParseInt(tokens[j + 1]),
+				ParseInt(tokens[j + 2]), ParseInt(tokens[j + 3])));
+			if (scores)
+				scores->push_back(ParseDouble(tokens[j + 4]));
+			if (*labeled)
+				labels.push_back(ParseInt(tokens[j + fields]));
+		}
+		return true;
+	}
+
+
+	enum ScoreLine{ SCORE_SKIPPED, SCORE_PARSED, SCORE_ILLEGAL };
+
+	// Parse a tokenized line of a score file, scores are appended to values
+	static ScoreLine ParseScoreTokens(const std::vector<Token>& tokens, std::vector<float>& values)
+	{
+		if (HasComment(tokens[0]))
+			return SCORE_SKIPPED;
+
+		int obj_num = ParseInt(tokens[0]);
+		if (obj_num < 0 || obj_num > (int)tokens.size() - 1)
+			return SCORE_ILLEGAL;
+		for (int i = 0; i < obj_num; i++){
+			values.push_back(ParseDouble(tokens[i + 1]));
+		}
+		return SCORE_PARSED;
+	}
+
+
+	void ParseAnnotationText(const char* begin, const char* end, AnnotationList& annotations,
+		std::vector<unsigned long long>* line_ends, ScoreList* scores)
+	{
+		ProfileCount(COUNT_BYTES_PARSED, end - begin);
+		if (annotations.offsets.empty())
+			annotations.offsets.push_back(annotations.rects.size());
+		if (scores && scores->offsets.empty())
+			scores->offsets.push_back(scores->scores.size());
+
+		std::vector<Token> tokens;
+		std::string imgpath;
+		std::vector<int> line_labels;
+		const char* ptr = begin;
+		while (ptr < end){
+			const char* line_end;
+			const char* line = ptr;
+			ptr = NextLine(ptr, end, &line_end);
+			SplitLine(line, line_end, tokens);
+
+			size_t rect_num = annotations.rects.size();
+			bool labeled;
+			line_labels.clear();
+			if (!ParseAnnotationTokens(tokens, imgpath, annotations.rects, line_labels, &labeled, scores ? &scores->scores : 0))
 				continue;
+			// labels are kept once any line has them, rectangles before that get class 0
+			if (labeled || annotations.has_labels()){
+				annotations.labels.resize(rect_num, 0);
+				annotations.labels.insert(annotations.labels.end(), line_labels.begin(), line_labels.end());
+				annotations.labels.resize(annotations.rects.size(), 0);
+			}
+			annotations.imgpathlist.push_back(imgpath);
+			annotations.offsets.push_back(annotations.rects.size());
+			if (scores)
+				scores->offsets.push_back(scores->scores.size());
+			if (line_ends)
+				line_ends->push_back(ptr - begin);
+		}
+	}
+
+
+	bool ParseScoreText(const char* begin, const char* end, ScoreList& scores, int* error_line,
+		std::vector<unsigned long long>* line_ends)
+	{
+		ProfileCount(COUNT_BYTES_PARSED, end - begin);
+		if (scores.offsets.empty())
+			scores.offsets.push_back(scores.scores.size());
+
+		std::vector<Token> tokens;
+		const char* ptr = begin;
+		int line_num = 0;
+		while (ptr < end){
+			const char* line_end;
+			const char* line = ptr;
+			ptr = NextLine(ptr, end, &line_end);
+			line_num++;
+			SplitLine(line, line_end, tokens);
+
+			ScoreLine ret = ParseScoreTokens(tokens, scores.scores);
+			if (ret == SCORE_ILLEGAL){
+				if (error_line)
+					*error_line = line_num;
+				return false;
+			}
+			if (ret == SCORE_PARSED){
+				scores.offsets.push_back(scores.scores.size());
+				if (line_ends)
+					line_ends->push_back(ptr - begin);
+			}
+		}
+
+		return true;
+	}
+
+
+	// Split [begin, end) into at most chunk_num ranges, each ending just after a newline
+	// (or at end); bounds holds the first byte of every range and end
+	static void SplitAtLines(const char* begin, const char* end, int chunk_num, std::vector<const char*>& bounds)
+	{
+		bounds.assign(1, begin);
+		size_t size = end - begin;
+		for (int c = 1; c < chunk_num; c++){
+			const char* pos = std::max(begin + size * c / chunk_num, bounds.back());
+			const char* eol = static_cast<const char*>(memchr(pos, '\n', end - pos));
+			if (!eol || eol + 1 == end)
+				break;
+			bounds.push_back(eol + 1);
+		}
+		if (bounds.back() != end)
+			bounds.push_back(end);
+	}
+
+
+	static int ParseThreads(const char* begin, const char* end, int num_threads)
+	{
+		if (num_threads == 0)
+			num_threads = hardware_threads();
+		return (end - begin < PARSE_CHUNK_MIN) ? 1 : num_threads;
+	}
+
+
+	void ParseAnnotationTextParallel(const char* begin, const char* end, AnnotationList& annotations, int num_threads,
+		ScoreList* scores)
+	{
+		int T = ParseThreads(begin, end, num_threads);
+		if (T <= 1){
+			ParseAnnotationText(begin, end, annotations, 0, scores);
+			return;
+		}
+
+		std::vector<const char*> bounds;
+		SplitAtLines(begin, end, T, bounds);
+		int C = bounds.size() - 1;
+		std::vector<AnnotationList> chunks(C);
+		std::vector<ScoreList> chunk_scores(scores ? C : 0);
+		parallel_for(0, C, [&](int c){
+			ParseAnnotationText(bounds[c], bounds[c + 1], chunks[c], 0, scores ? &chunk_scores[c] : 0);
+		}, T, 1);
+
+		// where the images and rectangles of each chunk go
+		if (annotations.offsets.empty())
+			annotations.offsets.push_back(annotations.rects.size());
+		std::vector<size_t> image_start(C + 1, annotations.size());
+		std::vector<size_t> rect_start(C + 1, annotations.rects.size());
+		bool labeled = annotations.has_labels();
+		for (int c = 0; c < C; c++){
+			image_start[c + 1] = image_start[c] + chunks[c].size();
+			rect_start[c + 1] = rect_start[c] + chunks[c].rects.size();
+			labeled = labeled || chunks[c].has_labels();
+		}
+		annotations.imgpathlist.resize(image_start[C]);
+		annotations.rects.resize(rect_start[C]);
+		annotations.offsets.resize(image_start[C] + 1);
+		if (labeled)
+			annotations.labels.resize(rect_start[C], 0);	// chunks without labels are class 0
+		// fused scores have the layout of the rectangles
+		if (scores){
+			if (scores->offsets.empty())
+				scores->offsets.push_back(scores->scores.size());
+			assert(scores->scores.size() == rect_start[0] && scores->size() == image_start[0]);
+			scores->scores.resize(rect_start[C]);
+			scores->offsets.resize(image_start[C] + 1);
+		}
+
+		parallel_for(0, C, [&](int c){
+			AnnotationList& chunk = chunks[c];
+			for (int i = 0; i < chunk.size(); i++){
+				annotations.imgpathlist[image_start[c] + i].swap(chunk.imgpathlist[i]);
+				annotations.offsets[image_start[c] + i + 1] = rect_start[c] + chunk.offsets[i + 1];
+			}
+			std::copy(chunk.rects.begin(), chunk.rects.end(), annotations.rects.begin() + rect_start[c]);
+			if (chunk.has_labels())
+				std::copy(chunk.labels.begin(), chunk.labels.end(), annotations.labels.begin() + rect_start[c]);
+			if (scores){
+				std::copy(chunk_scores[c].scores.begin(), chunk_scores[c].scores.end(), scores->scores.begin() + rect_start[c]);
+				std::copy(annotations.offsets.begin() + image_start[c] + 1, annotations.offsets.begin() + image_start[c + 1] + 1,
+					scores->offsets.begin() + image_start[c] + 1);
+				chunk_scores[c] = ScoreList();
+			}
+			chunk = AnnotationList();
+		}, T, 1);
+	}
+
+
+	bool ParseScoreTextParallel(const char* begin, const char* end, ScoreList& scores, int* error_line, int num_threads)
+	{
+		int T = ParseThreads(begin, end, num_threads);
+		if (T <= 1)
+			return ParseScoreText(begin, end, scores, error_line);
 
-			std::string first_char = (*it)[0];
-			if (first_char.empty() || first_char.find("#") != std::string::npos){
+		std::vector<const char*> bounds;
+		SplitAtLines(begin, end, T, bounds);
+		int C = bounds.size() - 1;
+		std::vector<ScoreList> chunks(C);
+		std::vector<char> parsed(C);
+		std::vector<int> chunk_error(C, 0);
+		parallel_for(0, C, [&](int c){
+			parsed[c] = ParseScoreText(bounds[c], bounds[c + 1], chunks[c], &chunk_error[c]);
+		}, T, 1);
+
+		// the first illegal line in the file, numbered after the lines of the chunks before it
+		for (int c = 0; c < C; c++){
+			if (parsed[c])
 				continue;
+			if (error_line){
+				*error_line = chunk_error[c];
+				for (int k = 0; k < c; k++)
+					*error_line += std::count(bounds[k], bounds[k + 1], '\n');
 			}
+			return false;
+		}
+
+		if (scores.offsets.empty())
+			scores.offsets.push_back(scores.scores.size());
+		std::vector<size_t> image_start(C + 1, scores.size());
+		std::vector<size_t> score_start(C + 1, scores.scores.size());
+		for (int c = 0; c < C; c++){
+			image_start[c + 1] = image_start[c] + chunks[c].size();
+			score_start[c + 1] = score_start[c] + chunks[c].scores.size();
+		}
+		scores.scores.resize(score_start[C]);
+		scores.offsets.resize(image_start[C] + 1);
+
+		parallel_for(0, C, [&](int c){
+			ScoreList& chunk = chunks[c];
+			for (int i = 0; i < chunk.size(); i++)
+				scores.offsets[image_start[c] + i + 1] = score_start[c] + chunk.offsets[i + 1];
+			std::copy(chunk.scores.begin(), chunk.scores.end(), scores.scores.begin() + score_start[c]);
+			chunk = ScoreList();
+		}, T, 1);
+		return true;
+	}
 
-			std::vector<float> values;
-			int obj_num = atoi((*it)[0].c_str());
-			if (obj_num > it->size() - 1){
-				std::cerr << "Error: illegal format at line " << std::distance(tokenized_strings.begin(), it) + 1 
-					<< " in " << score_file << std::endl;
+
+	struct LineReader{
+		std::ifstream ifs;
+		std::string buf;
+		std::vector<Token> tokens;
+		int line_num;
+
+		// read and tokenize the next line
+		bool next()
+		{
+			if (!ifs || !std::getline(ifs, buf))
 				return false;
+			line_num++;
+			ProfileCount(COUNT_BYTES_PARSED, buf.size() + 1);
+			const char* begin = buf.c_str();
+			const char* line_end;
+			NextLine(begin, begin + buf.size(), &line_end);
+			SplitLine(begin, line_end, tokens);
+			return true;
+		}
+	};
+
+
+	struct AnnotationReader::Impl : public LineReader{};
+
+
+	bool AnnotationReader::open(const std::string& filename)
+	{
+		impl_ = std::make_shared<Impl>();
+		impl_->ifs.open(filename);
+		impl_->line_num = 0;
+		return impl_->ifs.is_open();
+	}
+
+
+	bool AnnotationReader::read(std::string& imgpath, std::vector<cv::Rect>& rects)
+	{
+		rects.clear();
+		std::vector<int> labels;
+		bool labeled;
+		while (impl_->next()){
+			if (ParseAnnotationTokens(impl_->tokens, imgpath, rects, labels, &labeled)){
+				labeled_ = labeled_ || labeled;
+				return true;
 			}
-			for (int i = 0; i<obj_num; i++){
-				int j = i + 1;
-				values.push_back(atof((*it)[j].c_str()));
+		}
+		return false;
+	}
+
+
+	struct ScoreReader::Impl : public LineReader{};
+
+
+	bool ScoreReader::open(const std::string& filename)
+	{
+		impl_ = std::make_shared<Impl>();
+		impl_->ifs.open(filename);
+		impl_->line_num = 0;
+		error_line_ = 0;
+		return impl_->ifs.is_open();
+	}
+
+
+	bool ScoreReader::read(std::vector<float>& scores)
+	{
+		scores.clear();
+		while (impl_->next()){
+			ScoreLine ret = ParseScoreTokens(impl_->tokens, scores);
+			if (ret == SCORE_PARSED)
+				return true;
+			if (ret == SCORE_ILLEGAL){
+				error_line_ = impl_->line_num;
+				return false;
 			}
-			scores.push_back(values);
+		}
+		return false;
+	}
+
+
+	// Binary annotation file (native little endian):
+	//   BinaryHeader
+	//   uint64 rect offset of each image [image_num + 1]
+	//   int32 x, y, width, height [rect_num each]
+	//   float32 score [rect_num] (BINARY_HAS_SCORE only)
+	//   uint64 offset of each image path [image_num + 1]
+	//   char image paths [string_bytes]
+	//   int32 class id [rect_num] (BINARY_HAS_LABEL only, after the strings so that older readers skip it)
+	// every section starts at a multiple of 8 bytes
+	static const char binary_magic[4] = { 'E', 'L', 'B', 'F' };
+	static const unsigned int binary_version = 1;
+	enum{ BINARY_HAS_SCORE = 1, BINARY_HAS_LABEL = 2 };
+
+	struct BinaryHeader{
+		char magic[4];
+		unsigned int version;
+		unsigned int flags;
+		unsigned int reserved;
+		unsigned long long image_num;
+		unsigned long long rect_num;
+		unsigned long long string_bytes;
+	};
+
+
+	static size_t Align8(size_t size)
+	{
+		return (size + 7) & ~(size_t)7;
+	}
+
+
+	// zeros up to the next multiple of 8 after a section of size bytes
+	static void WritePadding(std::ofstream& ofs, size_t size)
+	{
+		static const char zeros[8] = { 0 };
+		ofs.write(zeros, Align8(size) - size);
+	}
+
+
+	static void WritePadded(std::ofstream& ofs, const void* data, size_t size)
+	{
+		if (size > 0)
+			ofs.write(static_cast<const char*>(data), size);
+		WritePadding(ofs, size);
+	}
+
+
+	// Section positions in a binary file, false if the file is broken
+	struct BinaryLayout{
+		BinaryHeader header;
+		size_t rect_offsets, x, y, width, height, score, string_offsets, strings, labels;
+	};
+
+
+	static bool GetBinaryLayout(const MappedFile& file, BinaryLayout& layout)
+	{
+		if (file.size() < sizeof(BinaryHeader))
+			return false;
+		memcpy(&layout.header, file.data(), sizeof(BinaryHeader));
+		const BinaryHeader& h = layout.header;
+		if (memcmp(h.magic, binary_magic, sizeof(binary_magic)) != 0 || h.version != binary_version)
+			return false;
+		if (h.image_num >= file.size() || h.rect_num >= file.size() || h.string_bytes > file.size())
+			return false;
+
+		size_t offset_bytes = Align8((h.image_num + 1) * sizeof(unsigned long long));
+		size_t column_bytes = Align8(h.rect_num * sizeof(int));
+		layout.rect_offsets = sizeof(BinaryHeader);
+		layout.x = layout.rect_offsets + offset_bytes;
+		layout.y = layout.x + column_bytes;
+		layout.width = layout.y + column_bytes;
+		layout.height = layout.width + column_bytes;
+		layout.score = layout.height + column_bytes;
+		layout.string_offsets = layout.score + ((h.flags & BINARY_HAS_SCORE) ? column_bytes : 0);
+		layout.strings = layout.string_offsets + offset_bytes;
+		layout.labels = layout.strings + Align8(h.string_bytes);
+		if (h.flags & BINARY_HAS_LABEL)
+			return layout.labels + h.rect_num * sizeof(int) <= file.size();
+		return layout.strings + h.string_bytes <= file.size();
+	}
+
+
+	// read an offset table and check that it is monotonic within [0, limit]
+	static bool ReadOffsets(const MappedFile& file, size_t pos, size_t num, unsigned long long limit,
+		std::vector<unsigned long long>& offsets)
+	{
+		offsets.resize(num + 1);
+		memcpy(&offsets[0], file.data() + pos, offsets.size() * sizeof(unsigned long long));
+		if (offsets[0] != 0 || offsets[num] != limit)
+			return false;
+		for (size_t i = 0; i < num; i++){
+			if (offsets[i] > offsets[i + 1])
+				return false;
+		}
+		return true;
+	}
+
+
+	bool IsBinaryAnnotationFile(const std::string& filename)
+	{
+		std::ifstream ifs(filename, std::ios::binary);
+		char magic[sizeof(binary_magic)];
+		if (!ifs.read(magic, sizeof(magic)))
+			return false;
+		return memcmp(magic, binary_magic, sizeof(binary_magic)) == 0;
+	}
+
+
+	bool SaveBinaryAnnotationFile(const std::string& filename, const AnnotationList& annotations, const ScoreList* scores)
+	{
+		int N = annotations.size();
+		if (scores && scores->offsets != annotations.offsets){
+			std::cerr << "Error: the numbers of scores and objects are different." << std::endl;
+			return false;
+		}
+
+		std::ofstream ofs(filename, std::ios::binary);
+		if (!ofs.is_open())
+			return false;
+
+		std::vector<unsigned long long> rect_offsets(N + 1, 0), string_offsets(N + 1, 0);
+		for (int i = 0; i < N; i++){
+			rect_offsets[i + 1] = annotations.offsets[i + 1] - annotations.offsets[0];
+			string_offsets[i + 1] = string_offsets[i] + annotations.imgpathlist[i].size();
+		}
+
+		BinaryHeader header;
+		memcpy(header.magic, binary_magic, sizeof(binary_magic));
+		header.version = binary_version;
+		header.flags = (scores ? BINARY_HAS_SCORE : 0) | (annotations.has_labels() ? BINARY_HAS_LABEL : 0);
+		header.reserved = 0;
+		header.image_num = N;
+		header.rect_num = rect_offsets[N];
+		header.string_bytes = string_offsets[N];
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		WritePadded(ofs, &rect_offsets[0], rect_offsets.size() * sizeof(unsigned long long));
+
+		// columns
+		size_t rect_num = header.rect_num;
+		const cv::Rect* rects = rect_num > 0 ? &annotations.rects[annotations.offsets[0]] : 0;
+		std::vector<int> column(rect_num);
+		for (int c = 0; c < 4; c++){
+			for (size_t i = 0; i < rect_num; i++){
+				const cv::Rect& rect = rects[i];
+				column[i] = (c == 0) ? rect.x : (c == 1) ? rect.y : (c == 2) ? rect.width : rect.height;
+			}
+			WritePadded(ofs, rect_num > 0 ? &column[0] : 0, rect_num * sizeof(int));
+		}
+		if (scores)
+			WritePadded(ofs, rect_num > 0 ? &scores->scores[scores->offsets[0]] : 0, rect_num * sizeof(float));
+
+		// string table
+		WritePadded(ofs, &string_offsets[0], string_offsets.size() * sizeof(unsigned long long));
+		for (int i = 0; i < N; i++){
+			ofs.write(annotations.imgpathlist[i].data(), annotations.imgpathlist[i].size());
+		}
+		if (annotations.has_labels()){
+			WritePadding(ofs, header.string_bytes);
+			WritePadded(ofs, rect_num > 0 ? &annotations.labels[annotations.offsets[0]] : 0, rect_num * sizeof(int));
+		}
+
+		return ofs.good();
+	}
+
+
+	bool LoadBinaryAnnotationFile(const std::string& filename, AnnotationList& annotations, ScoreList* scores)
+	{
+		MappedFile file;
+		BinaryLayout layout;
+		if (!file.open(filename) || !GetBinaryLayout(file, layout)){
+			std::cerr << "Error: " << filename << " is not a valid binary annotation file." << std::endl;
+			return false;
+		}
+		ProfileCount(COUNT_BYTES_PARSED, file.size());
+		const BinaryHeader& h = layout.header;
+		if (scores && !(h.flags & BINARY_HAS_SCORE)){
+			std::cerr << "Error: " << filename << " has no score." << std::endl;
+			return false;
+		}
+
+		std::vector<unsigned long long> rect_offsets, string_offsets;
+		if (!ReadOffsets(file, layout.rect_offsets, h.image_num, h.rect_num, rect_offsets) ||
+			!ReadOffsets(file, layout.string_offsets, h.image_num, h.string_bytes, string_offsets)){
+			std::cerr << "Error: " << filename << " is not a valid binary annotation file." << std::endl;
+			return false;
+		}
+
+		size_t N = h.image_num;
+		const char* strings = file.data() + layout.strings;
+		if (annotations.offsets.empty())
+			annotations.offsets.push_back(annotations.rects.size());
+		size_t base = annotations.rects.size();
+		for (size_t i = 0; i < N; i++){
+			annotations.imgpathlist.push_back(std::string(strings + string_offsets[i], strings + string_offsets[i + 1]));
+			annotations.offsets.push_back(base + rect_offsets[i + 1]);
+		}
+
+		size_t rect_num = h.rect_num;
+		annotations.rects.resize(base + rect_num);
+		const char* columns[4] = { file.data() + layout.x, file.data() + layout.y,
+			file.data() + layout.width, file.data() + layout.height };
+		for (size_t i = 0; i < rect_num; i++){
+			int values[4];
+			for (int c = 0; c < 4; c++){
+				memcpy(&values[c], columns[c] + i * sizeof(int), sizeof(int));
+			}
+			annotations.rects[base + i] = cv::Rect(values[0], values[1], values[2], values[3]);
+		}
+		if ((h.flags & BINARY_HAS_LABEL) || annotations.has_labels()){
+			annotations.labels.resize(base + rect_num, 0);
+			if ((h.flags & BINARY_HAS_LABEL) && rect_num > 0)
+				memcpy(&annotations.labels[base], file.data() + layout.labels, rect_num * sizeof(int));
+		}
+
+		if (scores){
+			if (scores->offsets.empty())
+				scores->offsets.push_back(scores->scores.size());
+			size_t score_base = scores->scores.size();
+			scores->scores.resize(score_base + rect_num);
+			if (rect_num > 0)
+				memcpy(&scores->scores[score_base], file.data() + layout.score, rect_num * sizeof(float));
+			for (size_t i = 0; i < N; i++){
+				scores->offsets.push_back(score_base + rect_offsets[i + 1]);
+			}
+		}
+
+		return true;
+	}
+
+
+	bool HasBinaryScores(const std::string& filename)
+	{
+		MappedFile file;
+		BinaryLayout layout;
+		return file.open(filename) && GetBinaryLayout(file, layout) && (layout.header.flags & BINARY_HAS_SCORE);
+	}
+
+
+	// FNV-1a over 8-byte words with a shift to carry high bits down, then the tail bytes
+	static unsigned long long HashBytes(const char* data, size_t size)
+	{
+		const unsigned long long prime = 1099511628211ULL;
+		unsigned long long h = 14695981039346656037ULL;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			unsigned long long word;
+			memcpy(&word, data + i, sizeof(word));
+			h = (h ^ word) * prime;
+			h ^= h >> 29;
+		}
+		for (; i < size; i++){
+			h = (h ^ (unsigned char)data[i]) * prime;
+		}
+		return (h ^ size) * prime;
+	}
+
+
+	// second hash over 8-byte words, independent of HashBytes(): multiply, rotate and a final avalanche
+	static unsigned long long CheckBytes(const char* data, size_t size)
+	{
+		const unsigned long long k1 = 0x9E3779B97F4A7C15ULL;
+		const unsigned long long k2 = 0xC2B2AE3D27D4EB4FULL;
+		unsigned long long h = 0x27D4EB2F165667C5ULL ^ size;
+		size_t i = 0;
+		for (; i + 8 <= size; i += 8){
+			unsigned long long word;
+			memcpy(&word, data + i, sizeof(word));
+			h ^= word * k1;
+			h = ((h << 31) | (h >> 33)) * k2;
+		}
+		unsigned long long tail = 0;
+		if (i < size)
+			memcpy(&tail, data + i, size - i);
+		h ^= tail * k1;
+		h ^= h >> 33;
+		h *= 0xFF51AFD7ED558CCDULL;
+		h ^= h >> 33;
+		h *= 0xC4CEB9FE1A85EC53ULL;
+		return h ^ (h >> 33);
+	}
+
+
+	bool DigestFile(const std::string& filename, FileDigest* digest)
+	{
+		MappedFile file;
+		if (!file.open(filename))
+			return false;
+		digest->size = file.size();
+		digest->hash = HashBytes(file.data(), file.size());
+		digest->check = CheckBytes(file.data(), file.size());
+		return true;
+	}
+
+
+	bool HashFile(const std::string& filename, unsigned long long* hash)
+	{
+		MappedFile file;
+		if (!file.open(filename))
+			return false;
+		*hash = HashBytes(file.data(), file.size());
+		return true;
+	}
+
+
+	bool HashFileRange(const std::string& filename, unsigned long long begin, unsigned long long end,
+		unsigned long long* hash)
+	{
+		MappedFile file;
+		if (!file.open(filename) || begin > end || end > file.size())
+			return false;
+		*hash = HashBytes(file.data() + begin, end - begin);
+		return true;
+	}
+
+
+	// Match cache file (native little endian):
+	//   MatchCacheHeader
+	//   uint64 detection offset of each image [image_num + 1]
+	//   int32 binded index [detection_num]
+	//   float32 overlap score [detection_num]
+	// every section starts at a multiple of 8 bytes
+	static const char cache_magic[4] = { 'E', 'L', 'M', 'C' };
+	static const unsigned int cache_version = 2;
+
+	struct MatchCacheHeader{
+		char magic[4];
+		unsigned int version;
+		MatchCacheKey key;
+		unsigned long long image_num;
+		unsigned long long detection_num;
+		unsigned long long ground_truth_num;
+	};
+
+
+	static bool SameDigest(const FileDigest& left, const FileDigest& right)
+	{
+		return left.size == right.size && left.hash == right.hash && left.check == right.check;
+	}
+
+
+	static bool SameKey(const MatchCacheKey& left, const MatchCacheKey& right)
+	{
+		return SameDigest(left.local, right.local) && SameDigest(left.ground_truth, right.ground_truth) &&
+			SameDigest(left.score, right.score) && left.flags == right.flags &&
+			memcmp(&left.overlap_threshold, &right.overlap_threshold, sizeof(float)) == 0;
+	}
+
+
+	bool SaveMatchCache(const std::string& cache_file, const MatchCacheKey& key,
+		const FlatList<int>& binded_index, const FlatList<float>& overlap_score, int ground_truth_num)
+	{
+		assert(binded_index.offsets == overlap_score.offsets);
+
+		std::ofstream ofs(cache_file, std::ios::binary);
+		if (!ofs.is_open())
+			return false;
+
+		MatchCacheHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, cache_magic, sizeof(cache_magic));
+		header.version = cache_version;
+		header.key = key;
+		header.image_num = binded_index.size();
+		header.detection_num = binded_index.data.size();
+		header.ground_truth_num = ground_truth_num;
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		std::vector<unsigned long long> offsets(binded_index.offsets.begin(), binded_index.offsets.end());
+		WritePadded(ofs, &offsets[0], offsets.size() * sizeof(unsigned long long));
+		WritePadded(ofs, binded_index.data.empty() ? 0 : &binded_index.data[0], binded_index.data.size() * sizeof(int));
+		WritePadded(ofs, overlap_score.data.empty() ? 0 : &overlap_score.data[0], overlap_score.data.size() * sizeof(float));
+
+		return ofs.good();
+	}
+
+
+	bool LoadMatchCache(const std::string& cache_file, const MatchCacheKey& key,
+		FlatList<int>& binded_index, FlatList<float>& overlap_score, int* ground_truth_num)
+	{
+		MappedFile file;
+		if (!boost::filesystem::exists(cache_file) || !file.open(cache_file) || file.size() < sizeof(MatchCacheHeader))
+			return false;
+
+		MatchCacheHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, cache_magic, sizeof(cache_magic)) != 0 || header.version != cache_version ||
+			!SameKey(header.key, key))
+			return false;
+		if (header.image_num >= file.size() || header.detection_num >= file.size())
+			return false;
+
+		size_t N = header.image_num;
+		size_t M = header.detection_num;
+		size_t offsets_pos = sizeof(MatchCacheHeader);
+		size_t index_pos = offsets_pos + Align8((N + 1) * sizeof(unsigned long long));
+		size_t overlap_pos = index_pos + Align8(M * sizeof(int));
+		if (overlap_pos + M * sizeof(float) > file.size())
+			return false;
+
+		std::vector<unsigned long long> offsets;
+		if (!ReadOffsets(file, offsets_pos, N, M, offsets))
+			return false;
+
+		binded_index.offsets.assign(offsets.begin(), offsets.end());
+		overlap_score.offsets = binded_index.offsets;
+		binded_index.data.resize(M);
+		overlap_score.data.resize(M);
+		if (M > 0){
+			memcpy(&binded_index.data[0], file.data() + index_pos, M * sizeof(int));
+			memcpy(&overlap_score.data[0], file.data() + overlap_pos, M * sizeof(float));
+		}
+		*ground_truth_num = header.ground_truth_num;
+		return true;
+	}
+
+
+	bool LoadAnnotationFile(const std::string& gt_file, AnnotationList& annotations, int num_threads)
+	{
+		ScopedTimer timer("LoadAnnotationFile");
+		if (IsBinaryAnnotationFile(gt_file))
+			return LoadBinaryAnnotationFile(gt_file, annotations);
+
+		MappedFile file;
+		if (!file.open(gt_file))
+			return false;
+
+		ParseAnnotationTextParallel(file.data(), file.data() + file.size(), annotations, num_threads);
+		return true;
+	}
+
+
+	bool LoadScoreFile(const std::string& score_file, ScoreList& scores, int num_threads)
+	{
+		ScopedTimer timer("LoadScoreFile");
+		if (IsBinaryAnnotationFile(score_file)){
+			AnnotationList annotations;
+			return LoadBinaryAnnotationFile(score_file, annotations, &scores);
+		}
+
+		MappedFile file;
+		if (!file.open(score_file))
+			return false;
+
+		int error_line;
+		if (!ParseScoreTextParallel(file.data(), file.data() + file.size(), scores, &error_line, num_threads)){
+			std::cerr << "Error: illegal format at line " << error_line
+				<< " in " << score_file << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+
+	bool LoadFusedAnnotationFile(const std::string& local_file, AnnotationList& annotations, ScoreList& scores,
+		int num_threads)
+	{
+		ScopedTimer timer("LoadFusedAnnotationFile");
+		if (IsBinaryAnnotationFile(local_file)){
+			if (!HasBinaryScores(local_file)){
+				std::cerr << "Error: " << local_file << " has no scores" << std::endl;
+				return false;
+			}
+			return LoadBinaryAnnotationFile(local_file, annotations, &scores);
+		}
+
+		MappedFile file;
+		if (!file.open(local_file))
+			return false;
+
+		ParseAnnotationTextParallel(file.data(), file.data() + file.size(), annotations, num_threads, &scores);
+		return true;
+	}
+
+
+	bool LoadDifficultFile(const std::string& difficult_file, AnnotationList& ground_truth)
+	{
+		ScoreList flags;
+		if (!LoadScoreFile(difficult_file, flags))
+			return false;
+		if (flags.offsets != ground_truth.offsets){
+			std::cerr << "Error: flags in " << difficult_file << " do not match the ground truth" << std::endl;
+			return false;
+		}
+
+		ground_truth.difficult.resize(flags.scores.size());
+		for (size_t i = 0; i < flags.scores.size(); i++)
+			ground_truth.difficult[i] = flags.scores[i] != 0;
+		return true;
+	}
+
+
+	bool LoadIgnoreRegionFile(const std::string& region_file, AnnotationList& ground_truth)
+	{
+		AnnotationList regions;
+		if (!LoadAnnotationFile(region_file, regions))
+			return false;
+		if (regions.size() != ground_truth.size()){
+			std::cerr << "Error: " << region_file << " has " << regions.size() << " images, ground truth has "
+				<< ground_truth.size() << std::endl;
+			return false;
+		}
+
+		ground_truth.ignore_regions.swap(regions.rects);
+		ground_truth.ignore_offsets.swap(regions.offsets);
+		return true;
+	}
+
+
+	// complete lines of a mapped file after begin: [*first, *last), false if the file is shorter than begin
+	static bool CompleteLines(const MappedFile& file, unsigned long long begin, const char** first, const char** last)
+	{
+		if (begin > file.size())
+			return false;
+		*first = file.data() + begin;
+		*last = *first;
+		for (const char* ptr = file.data() + file.size(); ptr > *first; ptr--){
+			if (ptr[-1] == '\n'){
+				*last = ptr;
+				break;
+			}
+		}
+		return true;
+	}
+
+
+	bool LoadAnnotationTail(const std::string& filename, unsigned long long begin,
+		AnnotationList& annotations, std::vector<unsigned long long>& line_ends)
+	{
+		ScopedTimer timer("LoadAnnotationFile");
+		MappedFile file;
+		const char* first;
+		const char* last;
+		if (!file.open(filename) || !CompleteLines(file, begin, &first, &last))
+			return false;
+
+		line_ends.clear();
+		ParseAnnotationText(first, last, annotations, &line_ends);
+		for (size_t i = 0; i < line_ends.size(); i++)
+			line_ends[i] += begin;
+		return true;
+	}
+
+
+	bool LoadScoreTail(const std::string& filename, unsigned long long begin,
+		ScoreList& scores, std::vector<unsigned long long>& line_ends)
+	{
+		ScopedTimer timer("LoadScoreFile");
+		MappedFile file;
+		const char* first;
+		const char* last;
+		if (!file.open(filename) || !CompleteLines(file, begin, &first, &last))
+			return false;
+
+		int error_line;
+		line_ends.clear();
+		if (!ParseScoreText(first, last, scores, &error_line, &line_ends)){
+			std::cerr << "Error: illegal format at line " << error_line
+				<< " after byte " << begin << " in " << filename << std::endl;
+			return false;
+		}
+		for (size_t i = 0; i < line_ends.size(); i++)
+			line_ends[i] += begin;
+		return true;
+	}
+
+
+	// Evaluation state file (native little endian):
+	//   StateHeader
+	//   int32 true positive, false positive, miss detect [image_num * 3]
+	//   float32 score in ascending order [detection_num]
+	//   uint8 true positive [detection_num]
+	//   uint64 offset of each image path [image_num + 1]
+	//   char image paths [string_bytes]
+	// every section starts at a multiple of 8 bytes
+	static const char state_magic[4] = { 'E', 'L', 'I', 'S' };
+	static const unsigned int state_version = 1;
+
+	struct StateHeader{
+		char magic[4];
+		unsigned int version;
+		float score_threshold;
+		float overlap_threshold;
+		unsigned int flags;
+		int ground_truth_num;
+		unsigned long long consumed[3];
+		unsigned long long tail_hash[3];
+		unsigned long long image_num;
+		unsigned long long detection_num;
+		unsigned long long string_bytes;
+	};
+
+
+	void EvaluationState::clear()
+	{
+		score_threshold = 0;
+		overlap_threshold = 0;
+		flags = 0;
+		for (int i = 0; i < 3; i++){
+			consumed[i] = 0;
+			tail_hash[i] = 0;
+		}
+		ground_truth_num = 0;
+		img_files.clear();
+		counts.clear();
+		scores.clear();
+		true_positives.clear();
+	}
+
+
+	bool SaveEvaluationState(const std::string& state_file, const EvaluationState& state)
+	{
+		assert(state.counts.size() == state.img_files.size() * 3);
+		assert(state.scores.size() == state.true_positives.size());
+
+		std::ofstream ofs(state_file, std::ios::binary);
+		if (!ofs.is_open())
+			return false;
+
+		size_t N = state.img_files.size();
+		std::vector<unsigned long long> string_offsets(N + 1, 0);
+		for (size_t i = 0; i < N; i++)
+			string_offsets[i + 1] = string_offsets[i] + state.img_files[i].size();
+
+		StateHeader header;
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, state_magic, sizeof(state_magic));
+		header.version = state_version;
+		header.score_threshold = state.score_threshold;
+		header.overlap_threshold = state.overlap_threshold;
+		header.flags = state.flags;
+		header.ground_truth_num = state.ground_truth_num;
+		for (int i = 0; i < 3; i++){
+			header.consumed[i] = state.consumed[i];
+			header.tail_hash[i] = state.tail_hash[i];
+		}
+		header.image_num = N;
+		header.detection_num = state.scores.size();
+		header.string_bytes = string_offsets[N];
+		ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+		WritePadded(ofs, state.counts.empty() ? 0 : &state.counts[0], state.counts.size() * sizeof(int));
+		WritePadded(ofs, state.scores.empty() ? 0 : &state.scores[0], state.scores.size() * sizeof(float));
+		WritePadded(ofs, state.true_positives.empty() ? 0 : &state.true_positives[0], state.true_positives.size());
+		WritePadded(ofs, &string_offsets[0], string_offsets.size() * sizeof(unsigned long long));
+		for (size_t i = 0; i < N; i++){
+			ofs.write(state.img_files[i].data(), state.img_files[i].size());
+		}
+
+		return ofs.good();
+	}
+
+
+	bool LoadEvaluationState(const std::string& state_file, EvaluationState& state)
+	{
+		MappedFile file;
+		if (!boost::filesystem::exists(state_file) || !file.open(state_file) || file.size() < sizeof(StateHeader))
+			return false;
+
+		StateHeader header;
+		memcpy(&header, file.data(), sizeof(header));
+		if (memcmp(header.magic, state_magic, sizeof(state_magic)) != 0 || header.version != state_version)
+			return false;
+		if (header.image_num >= file.size() || header.detection_num >= file.size() || header.string_bytes > file.size())
+			return false;
+
+		size_t N = header.image_num;
+		size_t M = header.detection_num;
+		size_t counts_pos = sizeof(StateHeader);
+		size_t scores_pos = counts_pos + Align8(N * 3 * sizeof(int));
+		size_t true_positives_pos = scores_pos + Align8(M * sizeof(float));
+		size_t string_offsets_pos = true_positives_pos + Align8(M);
+		size_t strings_pos = string_offsets_pos + Align8((N + 1) * sizeof(unsigned long long));
+		if (strings_pos + header.string_bytes > file.size())
+			return false;
+
+		std::vector<unsigned long long> string_offsets;
+		if (!ReadOffsets(file, string_offsets_pos, N, header.string_bytes, string_offsets))
+			return false;
+
+		state.score_threshold = header.score_threshold;
+		state.overlap_threshold = header.overlap_threshold;
+		state.flags = header.flags;
+		state.ground_truth_num = header.ground_truth_num;
+		for (int i = 0; i < 3; i++){
+			state.consumed[i] = header.consumed[i];
+			state.tail_hash[i] = header.tail_hash[i];
+		}
+
+		state.counts.resize(N * 3);
+		state.scores.resize(M);
+		state.true_positives.resize(M);
+		if (N > 0)
+			memcpy(&state.counts[0], file.data() + counts_pos, N * 3 * sizeof(int));
+		if (M > 0){
+			memcpy(&state.scores[0], file.data() + scores_pos, M * sizeof(float));
+			memcpy(&state.true_positives[0], file.data() + true_positives_pos, M);
+		}
+
+		const char* strings = file.data() + strings_pos;
+		state.img_files.resize(N);
+		for (size_t i = 0; i < N; i++){
+			state.img_files[i].assign(strings + string_offsets[i], strings + string_offsets[i + 1]);
+		}
+		return true;
+	}
+
+
+	// hash index over strings owned by an AnnotationList
+	struct PathHash{
+		size_t operator()(const std::string* path) const { return std::hash<std::string>()(*path); }
+	};
+
+	struct PathEqual{
+		bool operator()(const std::string* left, const std::string* right) const { return *left == *right; }
+	};
+
+	typedef std::unordered_map<const std::string*, int, PathHash, PathEqual> PathIndex;
+
+
+	// append the i-th image of src (and its scores) to dst
+	static void AppendImage(const AnnotationList& src, const ScoreList* src_scores, int i,
+		AnnotationList& dst, ScoreList* dst_scores)
+	{
+		dst.imgpathlist.push_back(src.imgpathlist[i]);
+		dst.rects.insert(dst.rects.end(), src.rects.begin() + src.offsets[i], src.rects.begin() + src.offsets[i + 1]);
+		dst.offsets.push_back(dst.rects.size());
+		if (src.has_labels())
+			dst.labels.insert(dst.labels.end(), src.labels.begin() + src.offsets[i], src.labels.begin() + src.offsets[i + 1]);
+		if (dst_scores){
+			const std::vector<float>& scores = src_scores->scores;
+			dst_scores->scores.insert(dst_scores->scores.end(),
+				scores.begin() + src_scores->offsets[i], scores.begin() + src_scores->offsets[i + 1]);
+			dst_scores->offsets.push_back(dst_scores->scores.size());
+		}
+	}
+
+
+	bool JoinByImagePath(AnnotationList& detections, ScoreList* scores, AnnotationList& ground_truth,
+		int* detection_only, int* ground_truth_only)
+	{
+		int D = detections.size();
+		int G = ground_truth.size();
+		if (scores && scores->size() != D){
+			std::cerr << "Error: score file has " << scores->size() << " images, localization file has " << D << std::endl;
+			return false;
+		}
+
+		PathIndex detection_index(D * 2);
+		for (int d = 0; d < D; d++){
+			if (!detection_index.insert(PathIndex::value_type(&detections.imgpathlist[d], d)).second){
+				std::cerr << "Error: " << detections.imgpathlist[d] << " appears twice in localization file" << std::endl;
+				return false;
+			}
+		}
+		PathIndex ground_truth_index(G * 2);
+		for (int g = 0; g < G; g++){
+			if (!ground_truth_index.insert(PathIndex::value_type(&ground_truth.imgpathlist[g], g)).second){
+				std::cerr << "Error: " << ground_truth.imgpathlist[g] << " appears twice in ground truth file" << std::endl;
+				return false;
+			}
+		}
+
+		AnnotationList joined;
+		ScoreList joined_scores;
+		joined.imgpathlist.reserve(std::max(D, G));
+		joined.rects.reserve(detections.rects.size());
+		joined.offsets.reserve(std::max(D, G) + 1);
+		joined.offsets.push_back(0);
+		joined_scores.offsets.push_back(0);
+		if (scores){
+			joined_scores.scores.reserve(scores->scores.size());
+			joined_scores.offsets.reserve(std::max(D, G) + 1);
+		}
+
+		*ground_truth_only = 0;
+		for (int g = 0; g < G; g++){
+			PathIndex::const_iterator it = detection_index.find(&ground_truth.imgpathlist[g]);
+			if (it != detection_index.end()){
+				AppendImage(detections, scores, it->second, joined, scores ? &joined_scores : 0);
+			}
+			else{
+				joined.imgpathlist.push_back(ground_truth.imgpathlist[g]);
+				joined.offsets.push_back(joined.rects.size());
+				joined_scores.offsets.push_back(joined_scores.scores.size());
+				(*ground_truth_only)++;
+			}
+		}
+
+		// ground_truth is extended only after the lookups, as the index points into it
+		std::vector<int> unmatched;
+		for (int d = 0; d < D; d++){
+			if (!ground_truth_index.count(&detections.imgpathlist[d]))
+				unmatched.push_back(d);
+		}
+		*detection_only = unmatched.size();
+		if (ground_truth.offsets.empty())
+			ground_truth.offsets.push_back(ground_truth.rects.size());
+		for (int i = 0; i < unmatched.size(); i++){
+			AppendImage(detections, scores, unmatched[i], joined, scores ? &joined_scores : 0);
+			ground_truth.imgpathlist.push_back(detections.imgpathlist[unmatched[i]]);
+			ground_truth.offsets.push_back(ground_truth.rects.size());
+			if (!ground_truth.ignore_offsets.empty())
+				ground_truth.ignore_offsets.push_back(ground_truth.ignore_regions.size());
 		}
 
+		std::swap(detections, joined);
+		if (scores)
+			std::swap(*scores, joined_scores);
 		return true;
 	}
 
@@ -216,7 +1684,7 @@ namespace util{
 
 
 	void DrawTrueAndFalsePositive(const cv::Mat& img, cv::Mat& dst_img,
-		const std::vector<cv::Rect>& true_positives, const std::vector<cv::Rect>& false_positives,
+		Span<cv::Rect> true_positives, Span<cv::Rect> false_positives,
 		int thickness)
 	{
 		if (img.channels() == 1){
@@ -227,7 +1695,7 @@ namespace util{
 		}
 		else return;
 
-		std::vector<cv::Rect>::const_iterator it;
+		const cv::Rect* it;
 		for (it = false_positives.begin(); it != false_positives.end(); it++){
 			cv::rectangle(dst_img, *it, cv::Scalar(0, 0, 255), thickness);
 		}
@@ -35,13 +35,15 @@
 #define __UTIL__
 
 #include <opencv2/core/core.hpp>
+#include <memory>
+#include "flatlist.hpp"
+#include "textwriter.hpp"
 
 namespace util{
 
 	//! Ame[Vt@C̓ǂݍ
 	/*!
 	opencv_createsamles.exeƓ`̃Ame[Vt@Cǂݏ
-	ReadCsvFile()֐K{
 	\param[in] gt_file Ame[Vt@C
 	\param[out] imgpathlist 摜t@Cւ̃pX
 	\param[out] rectlist e摜ɂꂽAme[ṼXg
@@ -59,9 +61,314 @@ namespace util{
 	*/
 	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files, const std::vector<std::vector<cv::Rect>>& obj_rects, const std::string& sep = " ");
 
+	//! Write one line of an annotation file (used by SaveAnnotationFile())
+	void WriteAnnotationLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> rects, const std::string& sep = " ");
+
+	//! Save an annotation file from a flat list of rectangles
+	/*!
+	\param[in] num_threads number of threads to format large files (see write_rows())
+	*/
+	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files, const FlatList<cv::Rect>& obj_rects,
+		const std::string& sep = " ", int num_threads = 1);
+
+	//! Write one line of an annotation file with the class id after each rectangle (without them if labels is empty)
+	void WriteAnnotationLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> rects, Span<int> labels,
+		const std::string& sep = " ");
+
+	//! Save an annotation file with class ids (labels in the shape of obj_rects, or empty)
+	bool SaveAnnotationFile(const std::string& anno_file, const std::vector<std::string>& img_files,
+		const FlatList<cv::Rect>& obj_rects, const FlatList<int>& labels, const std::string& sep = " ", int num_threads = 1);
+
+	//! Save a score file in the format read by LoadScoreFile()
+	bool SaveScoreFile(const std::string& score_file, const std::vector<std::vector<float>>& scores);
+
+	//! Save the summary CSV: true positive, false positive and miss detect count of each image
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files,
+		const std::vector<std::vector<cv::Rect>>& ground_truth,
+		const std::vector<std::vector<cv::Rect>>& true_positives,
+		const std::vector<std::vector<cv::Rect>>& false_positives);
+
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files,
+		const FlatList<cv::Rect>& ground_truth,
+		const FlatList<cv::Rect>& true_positives,
+		const FlatList<cv::Rect>& false_positives,
+		int num_threads = 1);
+
+	//! Write the header and one line of the summary CSV (used by SaveSummary())
+	void WriteSummaryHeader(TextWriter& writer);
+	void WriteSummaryLine(TextWriter& writer, const std::string& img_file, Span<cv::Rect> ground_truth,
+		Span<cv::Rect> true_positives, Span<cv::Rect> false_positives);
+
+	//! Save a recall-precision curve as CSV (rows formatted on num_threads threads, see write_rows())
+	bool SaveRecallPrecisionCurve(const std::string& output_file,
+		const std::vector<float>& recall, const std::vector<float>& precision, const std::vector<float>& thresholds,
+		int num_threads = 1);
+
+	//! Save average precision of each overlap threshold and their mean as CSV
+	bool SaveAveragePrecisions(const std::string& output_file,
+		const std::vector<float>& overlap_ths, const std::vector<float>& average_precisions, float mean_ap);
+
 	//! XRAt@C̓ǂݍ
 	bool LoadScoreFile(const std::string& score_file, std::vector<std::vector<float>>& scores);
 
+	//! Annotations of all images in flat buffers
+	/*!
+	Rectangles of the i-th image are rects[offsets[i]] ... rects[offsets[i + 1] - 1].
+	A line of a text file may give a class id after each rectangle ("x y w h class",
+	recognized when the line has exactly 5 numbers per object); labels then holds the
+	class id of every rectangle (0 for lines without them), and is empty otherwise.
+	Ground truth may also carry a difficult flag of every rectangle and ignore regions
+	of each image (LoadDifficultFile(), LoadIgnoreRegionFile()); both are empty if not given.
+	*/
+	struct AnnotationList{
+		std::vector<std::string> imgpathlist;
+		std::vector<cv::Rect> rects;
+		std::vector<int> offsets;
+		std::vector<int> labels;
+		std::vector<char> difficult;
+		std::vector<cv::Rect> ignore_regions;	// regions of the i-th image are ignore_regions[ignore_offsets[i]] ...
+		std::vector<int> ignore_offsets;
+
+		int size() const { return imgpathlist.size(); }
+		bool has_labels() const { return !labels.empty(); }
+		bool has_ignore() const { return !difficult.empty() || !ignore_offsets.empty(); }
+	};
+
+	//! Scores of all images in a flat buffer, indexed in the same way as AnnotationList
+	struct ScoreList{
+		std::vector<float> scores;
+		std::vector<int> offsets;
+
+		int size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+	};
+
+	//! Read-only memory mapping of a whole file
+	class MappedFile{
+	public:
+		bool open(const std::string& filename);
+		void close();
+		const char* data() const { return data_; }
+		size_t size() const { return size_; }
+
+	private:
+		struct Impl;
+		std::shared_ptr<Impl> impl_;
+		const char* data_ = 0;
+		size_t size_ = 0;
+	};
+
+	//! Load an annotation file into flat buffers through a memory mapping (text or binary)
+	/*!
+	\param[in] num_threads threads to parse a large text file (1: serial, 0: all hardware threads)
+	*/
+	bool LoadAnnotationFile(const std::string& gt_file, AnnotationList& annotations, int num_threads = 1);
+
+	//! Load a score file into a flat buffer through a memory mapping (text, or the scores of a binary annotation file)
+	/*!
+	\param[in] num_threads threads to parse a large text file (1: serial, 0: all hardware threads)
+	*/
+	bool LoadScoreFile(const std::string& score_file, ScoreList& scores, int num_threads = 1);
+
+	//! Load a localization file with a score after each rectangle in one pass
+	/*!
+	Each object of a line is "x y w h score", or "x y w h score class" with class ids.
+	A binary annotation file must have the score column.
+	\param[in] num_threads threads to parse a large text file (1: serial, 0: all hardware threads)
+	*/
+	bool LoadFusedAnnotationFile(const std::string& local_file, AnnotationList& annotations, ScoreList& scores,
+		int num_threads = 1);
+
+	//! Load difficult flags of ground truth from a file in the format of a score file (non-zero: difficult)
+	/*!
+	The file has a line of "<number of objects> <flag> ..." for each image of ground_truth,
+	the layout of a score file for its localization file.
+	*/
+	bool LoadDifficultFile(const std::string& difficult_file, AnnotationList& ground_truth);
+
+	//! Load ignore regions from a file in the format of an annotation file, one line for each image of ground_truth
+	bool LoadIgnoreRegionFile(const std::string& region_file, AnnotationList& ground_truth);
+
+	//! Align detections and ground truth by image path instead of line order
+	/*!
+	Images keep the order of ground_truth. Images only in detections are appended with
+	no ground truth, so their detections are false positives; images only in ground_truth
+	get no detections, so their ground truth is missed. Paths are matched through a hash
+	index that refers to the loaded strings without copying them.
+	\param[in,out] detections reordered to the images of ground_truth
+	\param[in,out] scores scores of detections reordered with them (may be null)
+	\param[in,out] ground_truth images only in detections are appended
+	\param[out] detection_only number of images only in detections
+	\param[out] ground_truth_only number of images only in ground_truth
+	\return false if an image path appears twice in a file
+	*/
+	bool JoinByImagePath(AnnotationList& detections, ScoreList* scores, AnnotationList& ground_truth,
+		int* detection_only, int* ground_truth_only);
+
+	//! Check the magic number of a binary annotation file
+	bool IsBinaryAnnotationFile(const std::string& filename);
+
+	//! Check if a binary annotation file has the score column
+	bool HasBinaryScores(const std::string& filename);
+
+	//! Save annotations (and scores of the same layout) as a binary columnar file
+	/*!
+	x, y, width, height and score are stored as separate int32/float32 arrays
+	with a per-image offset table and a string table of image paths.
+	*/
+	bool SaveBinaryAnnotationFile(const std::string& filename, const AnnotationList& annotations, const ScoreList* scores = 0);
+
+	//! Load a binary annotation file through a memory mapping
+	/*!
+	\param[out] scores scores stored in the file (the file must have them if not NULL)
+	*/
+	bool LoadBinaryAnnotationFile(const std::string& filename, AnnotationList& annotations, ScoreList* scores = 0);
+
+	//! 64-bit hash of the contents of a file (read through a memory mapping)
+	bool HashFile(const std::string& filename, unsigned long long* hash);
+
+	//! 64-bit hash of bytes [begin, end) of a file, false if the file is shorter than end
+	bool HashFileRange(const std::string& filename, unsigned long long begin, unsigned long long end,
+		unsigned long long* hash);
+
+	//! Size and two independent 64-bit hashes of the contents of a file
+	struct FileDigest{
+		unsigned long long size;
+		unsigned long long hash;		// same as HashFile()
+		unsigned long long check;		// multiply-rotate hash with other constants
+	};
+
+	//! FileDigest of a file in one pass over a memory mapping
+	bool DigestFile(const std::string& filename, FileDigest* digest);
+
+	//! What the results of bindRectPairs() depend on: contents of the input files and the overlap threshold
+	struct MatchCacheKey{
+		FileDigest local;
+		FileDigest ground_truth;
+		FileDigest score;					// all 0 without a score file
+		float overlap_threshold;
+		unsigned int flags;					// MATCH_CACHE_JOINED if the files were joined by image path, MATCH_CACHE_FUSED if scores were in the localization file
+	};
+
+	enum{ MATCH_CACHE_JOINED = 1, MATCH_CACHE_FUSED = 2 };
+
+	//! Save results of bindRectPairs() to a cache file
+	bool SaveMatchCache(const std::string& cache_file, const MatchCacheKey& key,
+		const FlatList<int>& binded_index, const FlatList<float>& overlap_score, int ground_truth_num);
+
+	//! Load results of bindRectPairs() from a cache file through a memory mapping
+	/*!
+	\return false if the file does not exist, is broken or was made with another key
+	*/
+	bool LoadMatchCache(const std::string& cache_file, const MatchCacheKey& key,
+		FlatList<int>& binded_index, FlatList<float>& overlap_score, int* ground_truth_num);
+
+	//! Parse lines of an annotation file in [begin, end) and append them to annotations
+	/*!
+	\param[out] line_ends byte offset from begin just after the line of each parsed image (may be null)
+	\param[out] scores if not null, lines are in the fused format ("x y w h score" or "x y w h score class"
+	for each object) and the scores are appended to it in the layout of annotations
+	*/
+	void ParseAnnotationText(const char* begin, const char* end, AnnotationList& annotations,
+		std::vector<unsigned long long>* line_ends = 0, ScoreList* scores = 0);
+
+	//! Parse lines of a score file in [begin, end) and append them to scores
+	/*!
+	\param[out] error_line line number (1-origin in [begin, end)) of an illegal line
+	\param[out] line_ends byte offset from begin just after the line of each parsed image (may be null)
+	\return false if an illegal line was found
+	*/
+	bool ParseScoreText(const char* begin, const char* end, ScoreList& scores, int* error_line,
+		std::vector<unsigned long long>* line_ends = 0);
+
+	//! Text from this size is split among threads by ParseAnnotationTextParallel() and ParseScoreTextParallel()
+	enum{ PARSE_CHUNK_MIN = 1 << 22 };
+
+	//! ParseAnnotationText() on num_threads threads (0: all hardware threads)
+	/*!
+	[begin, end) is split into one range per thread at line boundaries. Each range is
+	parsed into its own buffers, which are then concatenated in order at the positions
+	given by prefix sums of their image and rectangle counts. The results are the same
+	as ParseAnnotationText().
+	*/
+	void ParseAnnotationTextParallel(const char* begin, const char* end, AnnotationList& annotations, int num_threads,
+		ScoreList* scores = 0);
+
+	//! ParseScoreText() on num_threads threads, error_line is counted from begin as well
+	bool ParseScoreTextParallel(const char* begin, const char* end, ScoreList& scores, int* error_line, int num_threads);
+
+	//! Parse the complete lines of a text annotation file after byte offset begin
+	/*!
+	A line still being written (without a line break) is left for the next call.
+	\param[out] line_ends byte offset in the file just after the line of each parsed image
+	*/
+	bool LoadAnnotationTail(const std::string& filename, unsigned long long begin,
+		AnnotationList& annotations, std::vector<unsigned long long>& line_ends);
+
+	//! Parse the complete lines of a text score file after byte offset begin (see LoadAnnotationTail())
+	bool LoadScoreTail(const std::string& filename, unsigned long long begin,
+		ScoreList& scores, std::vector<unsigned long long>& line_ends);
+
+	//! Results of the images evaluated so far, kept between runs of the incremental mode
+	struct EvaluationState{
+		float score_threshold;
+		float overlap_threshold;
+		unsigned int flags;						// STATE_HAS_SCORE if a score file was evaluated
+		unsigned long long consumed[3];			// bytes of the localization, ground truth and score files evaluated
+		unsigned long long tail_hash[3];		// hash of the last bytes before consumed, to find rewritten files
+		int ground_truth_num;
+		std::vector<std::string> img_files;
+		std::vector<int> counts;				// true positive, false positive and miss detect of each image
+		std::vector<float> scores;				// scores of all detections in ascending order
+		std::vector<unsigned char> true_positives;	// whether each of scores is a true positive
+
+		EvaluationState(){ clear(); }
+		void clear();
+	};
+
+	enum{ STATE_HAS_SCORE = 1 };
+
+	//! Save an evaluation state to a binary file
+	bool SaveEvaluationState(const std::string& state_file, const EvaluationState& state);
+
+	//! Load an evaluation state through a memory mapping, false if the file does not exist or is broken
+	bool LoadEvaluationState(const std::string& state_file, EvaluationState& state);
+
+	//! Save a summary file from the counts of EvaluationState (same format as SaveSummary())
+	bool SaveSummary(const std::string& output_file,
+		const std::vector<std::string>& img_files, const std::vector<int>& counts);
+
+	//! Read an annotation file one image at a time (same format as LoadAnnotationFile())
+	class AnnotationReader{
+	public:
+		bool open(const std::string& filename);
+		//! Read the next image, false at the end of the file
+		bool read(std::string& imgpath, std::vector<cv::Rect>& rects);
+		//! Whether a line read so far had class ids (they are not returned)
+		bool labeled() const { return labeled_; }
+
+	private:
+		struct Impl;
+		std::shared_ptr<Impl> impl_;
+		bool labeled_ = false;
+	};
+
+	//! Read a score file one image at a time (same format as LoadScoreFile())
+	class ScoreReader{
+	public:
+		bool open(const std::string& filename);
+		//! Read the next image, false at the end of the file or at an illegal line
+		bool read(std::vector<float>& scores);
+		//! Line number of the illegal line, 0 if there was none
+		int error_line() const { return error_line_; }
+
+	private:
+		struct Impl;
+		std::shared_ptr<Impl> impl_;
+		int error_line_ = 0;
+	};
+
 
 	bool ReadCSVFile(const std::string& input_file, std::vector<std::vector<std::string>>& output_strings,
 		const std::vector<std::string>& separater_vec = std::vector<std::string>());;
@@ -69,7 +376,7 @@ namespace util{
 	std::vector<std::string> TokenizeString(const std::string& input_string, const std::vector<std::string>& separater_vec);
 
 	void DrawTrueAndFalsePositive(const cv::Mat& img, cv::Mat& dst_img,
-		const std::vector<cv::Rect>& true_positives, const std::vector<cv::Rect>& false_positives,
+		Span<cv::Rect> true_positives, Span<cv::Rect> false_positives,
 		int thickness = 1);
 
 	template <typename T>
@@ -0,0 +1,139 @@
+/*M///////////////////////////////////////////////////////////////////////////////////////
+//
+//  IMPORTANT: READ BEFORE DOWNLOADING, COPYING, INSTALLING OR USING.
+//
+//  By downloading, copying, installing or using the software you agree to this license.
+//  If you do not agree to this license, do not download, install,
+//  copy or use the software.
+//
+//
+//                           License Agreement
+//
+// Copyright (C) 2014 Takuya MINAGAWA.
+// Third party copyrights are property of their respective owners.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights to
+// use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies
+// of the Software, and to permit persons to whom the Software is furnished to do
+// so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED,
+// INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A
+// PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+// OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+// SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+//
+//M*/
+
+// Tests of util:: routines against naive references, run by main() in debug builds
+
+#ifdef _DEBUG
+
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <sstream>
+#include <string>
+
+namespace{
+
+	// annotation text larger than PARSE_CHUNK_MIN with comments, blank lines, CRLF and class ids
+	std::string AnnotationText(bool fused, unsigned int seed)
+	{
+		std::mt19937 rng(seed);
+		std::ostringstream os;
+		for (int n = 0; os.tellp() < 3 * util::PARSE_CHUNK_MIN; n++){
+			if (n % 97 == 0)
+				os << "# comment " << n << "\n";
+			if (n % 101 == 0)
+				os << "\n";
+			int D = rng() % 8;
+			bool labeled = (n % 3 == 0);
+			os << "img/" << n << ".jpg " << D;
+			for (int d = 0; d < D; d++){
+				os << " " << rng() % 500 << " " << rng() % 500 << " " << rng() % 80 << " " << rng() % 80;
+				if (fused)
+					os << " " << (rng() % 1000) / 1000.0;
+				if (labeled)
+					os << " " << rng() % 5;
+			}
+			os << (n % 5 == 0 ? "\r\n" : "\n");
+		}
+		return os.str();
+	}
+
+
+	void ExpectSameAnnotations(const util::AnnotationList& expected, const util::AnnotationList& actual)
+	{
+		EXPECT_EQ(expected.imgpathlist, actual.imgpathlist);
+		EXPECT_EQ(expected.offsets, actual.offsets);
+		EXPECT_EQ(expected.labels, actual.labels);
+		ASSERT_EQ(expected.rects.size(), actual.rects.size());
+		for (int i = 0; i < expected.rects.size(); i++)
+			ASSERT_EQ(expected.rects[i], actual.rects[i]) << "rectangle " << i;
+	}
+
+}
+
+
+TEST(ParseTextTest, ParallelAnnotationsEqualSerial)
+{
+	for (int fused = 0; fused <= 1; fused++){
+		std::string text = AnnotationText(fused != 0, 7 + fused);
+		const char* begin = text.data();
+		const char* end = begin + text.size();
+
+		util::AnnotationList serial;
+		util::ScoreList serial_scores;
+		util::ParseAnnotationText(begin, end, serial, 0, fused ? &serial_scores : 0);
+		for (int threads = 2; threads <= 5; threads += 3){
+			util::AnnotationList parallel;
+			util::ScoreList parallel_scores;
+			util::ParseAnnotationTextParallel(begin, end, parallel, threads, fused ? &parallel_scores : 0);
+			ExpectSameAnnotations(serial, parallel);
+			EXPECT_EQ(serial_scores.scores, parallel_scores.scores);
+			EXPECT_EQ(serial_scores.offsets, parallel_scores.offsets);
+		}
+	}
+}
+
+
+TEST(ParseTextTest, ParallelScoresEqualSerialWithErrorLine)
+{
+	std::mt19937 rng(11);
+	std::ostringstream os;
+	int lines = 0;
+	while (os.tellp() < 3 * util::PARSE_CHUNK_MIN){
+		int D = rng() % 8;
+		os << D;
+		for (int d = 0; d < D; d++)
+			os << " " << (rng() % 1000) / 1000.0;
+		os << "\n";
+		lines++;
+	}
+	std::string text = os.str();
+
+	util::ScoreList serial, parallel;
+	int serial_error = 0, parallel_error = 0;
+	EXPECT_TRUE(util::ParseScoreText(text.data(), text.data() + text.size(), serial, &serial_error));
+	EXPECT_TRUE(util::ParseScoreTextParallel(text.data(), text.data() + text.size(), parallel, &parallel_error, 4));
+	EXPECT_EQ(serial.scores, parallel.scores);
+	EXPECT_EQ(serial.offsets, parallel.offsets);
+
+	// an illegal line (more objects than scores) late in the text is reported at the same line
+	std::string broken = text + "5 0.1 0.2\n" + text;
+	util::ScoreList serial_broken, parallel_broken;
+	serial_error = parallel_error = 0;
+	EXPECT_FALSE(util::ParseScoreText(broken.data(), broken.data() + broken.size(), serial_broken, &serial_error));
+	EXPECT_FALSE(util::ParseScoreTextParallel(broken.data(), broken.data() + broken.size(), parallel_broken, &parallel_error, 4));
+	EXPECT_EQ(lines + 1, serial_error);
+	EXPECT_EQ(serial_error, parallel_error);
+}
+
+#endif
@@ -1,37 +1,184 @@
+#ifndef __ARGSORT__
+#define __ARGSORT__
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
+#include <vector>
+#include "parallel.hpp"
 
 namespace util{
 
+	enum SortOrder{ SORT_ASCENDING, SORT_DESCENDING };
+
+	//! Sizes from which argsort() takes the radix path (float keys) and the parallel path
+	enum{ ARGSORT_RADIX_MIN = 256, ARGSORT_PARALLEL_MIN = 65536 };
+
 	template <typename T>
 	struct ARG_SORTER
 	{
 		T	val;
 		int idx;
+	};
+
+	// order of ARG_SORTER, ties by index
+	template <typename T>
+	struct ArgSorterLess
+	{
+		bool descending;
 
-		bool operator<(const struct ARG_SORTER& right) const{
-			return val < right.val;
+		bool operator()(const ARG_SORTER<T>& left, const ARG_SORTER<T>& right) const{
+			if (descending ? right.val < left.val : left.val < right.val)
+				return true;
+			if (descending ? left.val < right.val : right.val < left.val)
+				return false;
+			return left.idx < right.idx;
 		}
 	};
 
-	template <typename T>
-	void argsort_vector(const std::vector<T>& vec, std::vector<int>& idx)
+
+	// Sort records with chunk_sort(begin, end), on num_threads threads for large arrays:
+	// chunks of consecutive records are sorted in parallel and merged pair by pair.
+	// std::merge takes the left chunk first on ties, so the result equals a serial sort by less.
+	template <typename Rec, typename Less, typename ChunkSort>
+	void sort_in_chunks(std::vector<Rec>& records, const Less& less, const ChunkSort& chunk_sort, int num_threads)
 	{
-		int vec_size = vec.size();
-		std::vector<struct ARG_SORTER<T>> sort_pairs;
-		for (int i = 0; i < vec_size; i++){
-			struct ARG_SORTER<T> argsorter;
-			argsorter.val = vec[i];
-			argsorter.idx = i;
-			sort_pairs.push_back(argsorter);
+		int n = records.size();
+		if (num_threads == 0)
+			num_threads = hardware_threads();
+		if (num_threads <= 1 || n < ARGSORT_PARALLEL_MIN){
+			if (n > 0)
+				chunk_sort(&records[0], &records[0] + n);
+			return;
 		}
 
-		std::sort(sort_pairs.begin(), sort_pairs.end());
+		int T = num_threads;
+		std::vector<int> bounds(T + 1);
+		for (int t = 0; t <= T; t++)
+			bounds[t] = (int)((long long)n * t / T);
+		parallel_for(0, T, [&](int t){
+			chunk_sort(&records[0] + bounds[t], &records[0] + bounds[t + 1]);
+		}, T, 1);
 
-		idx.clear();
-		for (int i = 0; i < vec_size; i++){
-			idx.push_back(sort_pairs[i].idx);
+		std::vector<Rec> buffer(n);
+		for (int width = 1; width < T; width *= 2){
+			int pairs = (T + 2 * width - 1) / (2 * width);
+			parallel_for(0, pairs, [&](int p){
+				int lo = bounds[2 * p * width];
+				int mid = bounds[std::min(2 * p * width + width, T)];
+				int hi = bounds[std::min(2 * p * width + 2 * width, T)];
+				std::merge(records.begin() + lo, records.begin() + mid, records.begin() + mid, records.begin() + hi,
+					buffer.begin() + lo, less);
+			}, T, 1);
+			records.swap(buffer);
 		}
 	}
 
-}
\ No newline at end of file
+
+	// unsigned integer in the order of float values (-0 and 0 are equal)
+	inline unsigned int float_sort_key(float value)
+	{
+		if (value == 0)
+			value = 0;
+		unsigned int bits;
+		memcpy(&bits, &value, sizeof(bits));
+		return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+	}
+
+
+	// LSD radix sort of records by their upper 32 bits, stable, so ties keep the order of the lower bits
+	inline void radix_sort_upper(unsigned long long* begin, unsigned long long* end)
+	{
+		size_t n = end - begin;
+		size_t count[4][256] = {};
+		for (size_t i = 0; i < n; i++){
+			unsigned int key = (unsigned int)(begin[i] >> 32);
+			for (int b = 0; b < 4; b++)
+				count[b][(key >> (8 * b)) & 0xff]++;
+		}
+
+		std::vector<unsigned long long> buffer(n);
+		unsigned long long* src = begin;
+		unsigned long long* dst = &buffer[0];
+		for (int b = 0; b < 4; b++){
+			int shift = 32 + 8 * b;
+			if (count[b][(src[0] >> shift) & 0xff] == n)
+				continue;	// every record has the same byte
+			size_t pos = 0;
+			for (int v = 0; v < 256; v++){
+				size_t c = count[b][v];
+				count[b][v] = pos;
+				pos += c;
+			}
+			for (size_t i = 0; i < n; i++)
+				dst[count[b][(src[i] >> shift) & 0xff]++] = src[i];
+			std::swap(src, dst);
+		}
+		if (src != begin)
+			std::copy(src, src + n, begin);
+	}
+
+
+	//! Indices that sort keys[0] ... keys[n - 1]
+	/*!
+	Ties are in ascending order of index, so results are the same on every run, platform
+	and number of threads. float keys are sorted by radix sort from ARGSORT_RADIX_MIN keys.
+	\param[in] num_threads number of threads from ARGSORT_PARALLEL_MIN keys (1: serial, 0: all hardware threads)
+	*/
+	template <typename T>
+	void argsort(const T* keys, int n, std::vector<int>& idx, SortOrder order = SORT_ASCENDING, int num_threads = 1)
+	{
+		std::vector<ARG_SORTER<T>> sort_pairs(n);
+		for (int i = 0; i < n; i++){
+			sort_pairs[i].val = keys[i];
+			sort_pairs[i].idx = i;
+		}
+
+		ArgSorterLess<T> less;
+		less.descending = (order == SORT_DESCENDING);
+		sort_in_chunks(sort_pairs, less, [&](ARG_SORTER<T>* begin, ARG_SORTER<T>* end){
+			std::sort(begin, end, less);
+		}, num_threads);
+
+		idx.resize(n);
+		for (int i = 0; i < n; i++)
+			idx[i] = sort_pairs[i].idx;
+	}
+
+
+	inline void argsort(const float* keys, int n, std::vector<int>& idx, SortOrder order = SORT_ASCENDING, int num_threads = 1)
+	{
+		// key in the upper 32 bits and index in the lower, so the records are unique and ties go by index
+		std::vector<unsigned long long> records(n);
+		unsigned int flip = (order == SORT_DESCENDING) ? 0xffffffffu : 0;
+		for (int i = 0; i < n; i++)
+			records[i] = ((unsigned long long)(float_sort_key(keys[i]) ^ flip) << 32) | (unsigned int)i;
+
+		sort_in_chunks(records, std::less<unsigned long long>(), [](unsigned long long* begin, unsigned long long* end){
+			if (end - begin >= ARGSORT_RADIX_MIN)
+				radix_sort_upper(begin, end);
+			else
+				std::sort(begin, end);
+		}, num_threads);
+
+		idx.resize(n);
+		for (int i = 0; i < n; i++)
+			idx[i] = (int)(records[i] & 0xffffffffu);
+	}
+
+
+	template <typename T>
+	void argsort_vector(const T* vec, int vec_size, std::vector<int>& idx)
+	{
+		argsort(vec, vec_size, idx);
+	}
+
+	template <typename T>
+	void argsort_vector(const std::vector<T>& vec, std::vector<int>& idx)
+	{
+		argsort(vec.empty() ? 0 : &vec[0], vec.size(), idx);
+	}
+
+}
+
+#endif
\ No newline at end of file
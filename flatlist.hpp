@@ -0,0 +1,113 @@
+#ifndef __FLATLIST__
+#define __FLATLIST__
+
+#include <vector>
+
+namespace util{
+
+	//! Read-only view of count elements in a contiguous buffer
+	/*!
+	A std::vector converts to a Span implicitly, so functions taking a Span
+	accept both a vector and one image of a FlatList.
+	*/
+	template <typename T>
+	struct Span{
+		const T* data;
+		int count;
+
+		Span() : data(0), count(0){}
+		Span(const T* data, int count) : data(data), count(count){}
+		Span(const std::vector<T>& vec) : data(vec.empty() ? 0 : &vec[0]), count(vec.size()){}
+
+		int size() const { return count; }
+		bool empty() const { return count == 0; }
+		const T& operator[](int i) const { return data[i]; }
+		const T* begin() const { return data; }
+		const T* end() const { return data + count; }
+	};
+
+
+	//! Per-image arrays of a whole data set in one buffer
+	/*!
+	Elements of the n-th image are data[offsets[n]] ... data[offsets[n + 1] - 1],
+	the layout of AnnotationList and ScoreList. A data set takes two allocations
+	instead of one per image, and the buffers are reused when a list is filled again.
+	*/
+	template <typename T>
+	struct FlatList{
+		std::vector<T> data;
+		std::vector<int> offsets;
+
+		FlatList() : offsets(1, 0){}
+
+		//! number of images
+		int size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+		bool empty() const { return size() == 0; }
+		int count(int n) const { return offsets[n + 1] - offsets[n]; }
+
+		Span<T> operator[](int n) const
+		{
+			return Span<T>(data.empty() ? 0 : &data[0] + offsets[n], count(n));
+		}
+
+		//! writable pointer to the elements of the n-th image
+		T* at(int n) { return data.empty() ? 0 : &data[0] + offsets[n]; }
+
+		//! Same number of elements per image as shape (contents are not initialized)
+		template <typename U>
+		void reshape(const FlatList<U>& shape)
+		{
+			offsets = shape.offsets;
+			data.resize(offsets.back());
+		}
+
+		void clear()
+		{
+			data.clear();
+			offsets.assign(1, 0);
+		}
+
+		void push_back(Span<T> items)
+		{
+			data.insert(data.end(), items.begin(), items.end());
+			offsets.push_back(data.size());
+		}
+
+		void assign(const std::vector<std::vector<T>>& nested)
+		{
+			clear();
+			int total = 0;
+			for (int n = 0; n < nested.size(); n++)
+				total += nested[n].size();
+			data.reserve(total);
+			offsets.reserve(nested.size() + 1);
+			for (int n = 0; n < nested.size(); n++)
+				push_back(nested[n]);
+		}
+
+		void to_nested(std::vector<std::vector<T>>& nested) const
+		{
+			int N = size();
+			nested.resize(N);
+			for (int n = 0; n < N; n++)
+				nested[n].assign(data.begin() + offsets[n], data.begin() + offsets[n + 1]);
+		}
+	};
+
+
+	//! Elements all[n][ids[n][k]] in the shape of ids
+	template <typename T>
+	void gather(const FlatList<T>& all, const FlatList<int>& ids, FlatList<T>& output)
+	{
+		int N = all.size();
+		output.reshape(ids);
+		for (int n = 0; n < N; n++){
+			const T* elements = all[n].data;
+			for (int k = ids.offsets[n]; k < ids.offsets[n + 1]; k++)
+				output.data[k] = elements[ids.data[k]];
+		}
+	}
+
+}
+
+#endif
@@ -44,10 +44,15 @@ Recall-Precision Curve of area
 #include <opencv2/highgui/highgui.hpp>
 #include <boost/program_options.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/asio.hpp>
+#include <algorithm>
 #include <fstream>
 #include <iostream>
+#include <unordered_map>
 #include "Util.h"
 #include "EvalFunctions.h"
+#include "parallel.hpp"
+#include "Profiler.h"
 
 #ifdef _DEBUG
 #include <gtest/gtest.h>
@@ -58,27 +63,84 @@ using namespace boost::program_options;
 void print_help(int argc, char * argv[], const options_description& opt)
 {
 	std::cout << argv[0] << " <localization file> <ground truth file> <output file> [option]" << std::endl;
+	std::cout << argv[0] << " <ground truth file> --serve | --socket <path> [option]" << std::endl;
 	std::cout << opt << std::endl;
 }
 
 
+// "0.5,0.75" or "start:end:step" such as "0.5:0.95:0.05"
+bool ParseThresholdList(const std::string& str, std::vector<float>& thresholds)
+{
+	thresholds.clear();
+	if (str.find(":") != std::string::npos){
+		float start, end, step;
+		char sep1, sep2;
+		std::istringstream iss(str);
+		if (!(iss >> start >> sep1 >> end >> sep2 >> step) || sep1 != ':' || sep2 != ':' || step <= 0)
+			return false;
+		for (int i = 0; start + i * step <= end + step * 1e-3; i++){
+			thresholds.push_back(start + i * step);
+		}
+	}
+	else{
+		std::vector<std::string> sep;
+		sep.push_back(",");
+		std::vector<std::string> tokens = util::TokenizeString(str, sep);
+		for (int i = 0; i < tokens.size(); i++){
+			char* end;
+			float th = strtod(tokens[i].c_str(), &end);
+			if (tokens[i].empty() || *end != '\0')
+				return false;
+			thresholds.push_back(th);
+		}
+	}
+	return !thresholds.empty();
+}
+
+
 bool ParseCommandLine(int argc, char * argv[],
 	std::string& localization_file, std::string& ground_truth, std::string& output_file,
 	std::string& score_file, float* threshold, float* overlap_th,
 	std::string& rp_file, std::string& draw_directory, 
-	std::string& true_positive, std::string& false_positive)
+	std::string& true_positive, std::string& false_positive, int* num_threads, bool* stream,
+	std::vector<float>& overlap_ths, std::string& map_file,
+	std::string& draw_format, int* draw_quality, std::string& profile_file, bool* join,
+	int* bootstrap, unsigned int* bootstrap_seed, float* confidence, std::string& cache_file,
+	std::string& state_file, bool* all_point, int* rp_points, float* rp_error,
+	bool* serve, std::string& socket_path, std::string& difficult_file, std::string& region_file, bool* fused)
 {
 	// option argments
 	options_description opt("option");
 	opt.add_options()
 		("help,h", "Print help")
 		("score,s", value<std::string>(), "score file name binded to input localization file")
+		("fused", "input localization file has a score after each rectangle (x y w h score), instead of '-s'")
 		("scoreTh,c", value<float>()->default_value(0.5), "threshold of score")
 		("overlapTh,o", value<float>()->default_value(0.5), "threshold of overlap")
 		("draw,d", value<std::string>(), "directory to save result images which draw true positive and false positive with threshold '-st' and '-ot'")
 		("truePos,t", value<std::string>(), "output true positive file with threshold '-s' and '-o'")
 		("falsePos,f", value<std::string>(), "output false positive file with threshold '-s' and '-o'")
-		("rpCurve,r", value<std::string>(), "generate recall-precision curve with threshold '-o'");
+		("rpCurve,r", value<std::string>(), "generate recall-precision curve with threshold '-o'")
+		("rpPoints", value<int>()->default_value(0), "maximum number of points of '-r' (0: all)")
+		("rpError", value<float>()->default_value(0.0f), "drop points of '-r' within this recall and precision of a kept point (0: none)")
+		("allPoint", "all-point interpolated AP (VOC2010 and later) instead of 11-point (VOC2007)")
+		("jobs,j", value<int>()->default_value(1), "number of threads to parse and write large text files and match images (0: all cores)")
+		("stream", "evaluate one image at a time without loading whole files")
+		("join", "match images of the three files by image path instead of line order")
+		("overlapThs,m", value<std::string>(), "overlap thresholds to average AP over, list '0.5,0.75' or range '0.5:0.95:0.05' (with '-s')")
+		("mapFile", value<std::string>(), "output AP of each threshold of '-m' as CSV")
+		("bootstrap", value<int>()->default_value(0), "number of resamples of images to estimate the confidence interval of AP (with '-s')")
+		("bootstrapSeed", value<unsigned int>()->default_value(0), "random seed of '--bootstrap'")
+		("confidence", value<float>()->default_value(0.95f), "confidence level of '--bootstrap'")
+		("drawFormat", value<std::string>()->default_value("png"), "image format of '-d' (png, jpg, bmp, ...)")
+		("drawQuality", value<int>()->default_value(-1), "PNG compression level (0-9) or JPEG quality (0-100) of '-d' (-1: default)")
+		("state", value<std::string>(), "evaluate only lines appended since the run that saved this state file (with '-s')")
+		("cache", value<std::string>(), "file to keep matching results between runs with the same input files and '-o'")
+		("difficult", value<std::string>(), "difficult flags of ground truth in the format of a score file (non-zero: neither counted nor missed)")
+		("ignore", value<std::string>(), "regions of each ground truth image where detections are ignored, in the format of an annotation file")
+		("serve", "keep the ground truth in memory and evaluate batches of detections read from stdin")
+		("socket", value<std::string>(), "same as '--serve' on a Unix domain socket of this path")
+		("profile", value<std::string>(), "output time of each stage and counters as JSON (*.json) or CSV");
 
 	variables_map argmap;
 	try{
@@ -86,22 +148,46 @@ bool ParseCommandLine(int argc, char * argv[],
 		store(parse_command_line(argc, argv, opt), argmap);
 		notify(argmap);
 
+		// the server mode takes only the ground truth file
+		*serve = argmap.count("serve") > 0 || !argmap["socket"].empty();
+		if (!argmap["socket"].empty())
+			socket_path = argmap["socket"].as<std::string>();
+
 		// print help
-		if (argmap.count("help") || argc < 4){
+		if (argmap.count("help") || argc < (*serve ? 2 : 4)){
 			print_help(argc, argv, opt);
 			return false;
 		}
 
-		localization_file = argv[1];
-		ground_truth = argv[2];
-		output_file = argv[3];
-		if (localization_file.find("-") == 0 || ground_truth.find("-") == 0 || output_file.find("-") == 0){
-			print_help(argc, argv, opt);
-			return false;
+		if (*serve){
+			ground_truth = argv[1];
+			if (ground_truth.find("-") == 0){
+				print_help(argc, argv, opt);
+				return false;
+			}
+		}
+		else{
+			localization_file = argv[1];
+			ground_truth = argv[2];
+			output_file = argv[3];
+			if (localization_file.find("-") == 0 || ground_truth.find("-") == 0 || output_file.find("-") == 0){
+				print_help(argc, argv, opt);
+				return false;
+			}
 		}
 
 		*threshold = argmap["scoreTh"].as<float>();
 		*overlap_th = argmap["overlapTh"].as<float>();
+		*num_threads = argmap["jobs"].as<int>();
+		*stream = argmap.count("stream") > 0;
+		*join = argmap.count("join") > 0;
+		*fused = argmap.count("fused") > 0;
+		*bootstrap = argmap["bootstrap"].as<int>();
+		*bootstrap_seed = argmap["bootstrapSeed"].as<unsigned int>();
+		*confidence = argmap["confidence"].as<float>();
+		*all_point = argmap.count("allPoint") > 0;
+		*rp_points = argmap["rpPoints"].as<int>();
+		*rp_error = argmap["rpError"].as<float>();
 
 		if (!argmap["score"].empty())
 			score_file = argmap["score"].as<std::string>();
@@ -113,6 +199,27 @@ bool ParseCommandLine(int argc, char * argv[],
 			false_positive = argmap["falsePos"].as<std::string>();
 		if (!argmap["rpCurve"].empty())
 			rp_file = argmap["rpCurve"].as<std::string>();
+		if (!argmap["overlapThs"].empty()){
+			if (!ParseThresholdList(argmap["overlapThs"].as<std::string>(), overlap_ths)){
+				std::cout << "Illegal overlap thresholds: " << argmap["overlapThs"].as<std::string>() << std::endl;
+				print_help(argc, argv, opt);
+				return false;
+			}
+		}
+		if (!argmap["mapFile"].empty())
+			map_file = argmap["mapFile"].as<std::string>();
+		draw_format = argmap["drawFormat"].as<std::string>();
+		*draw_quality = argmap["drawQuality"].as<int>();
+		if (!argmap["profile"].empty())
+			profile_file = argmap["profile"].as<std::string>();
+		if (!argmap["cache"].empty())
+			cache_file = argmap["cache"].as<std::string>();
+		if (!argmap["state"].empty())
+			state_file = argmap["state"].as<std::string>();
+		if (!argmap["difficult"].empty())
+			difficult_file = argmap["difficult"].as<std::string>();
+		if (!argmap["ignore"].empty())
+			region_file = argmap["ignore"].as<std::string>();
 	}
 	catch (std::exception& e)
 	{
@@ -125,62 +232,76 @@ bool ParseCommandLine(int argc, char * argv[],
 }
 
 
-bool SaveSummary(const std::string& output_file,
-	const std::vector<std::string>& img_files,
-	const std::vector<std::vector<cv::Rect>>& ground_truth,
-	const std::vector<std::vector<cv::Rect>>& true_positives,
-	const std::vector<std::vector<cv::Rect>>& false_positives)
-{
-	assert(img_files.size() == ground_truth.size());
-	assert(img_files.size() == true_positives.size());
-	assert(false_positives.size() == true_positives.size());
-
-	std::ofstream ofs(output_file);
-	if (!ofs.is_open())
-		return false;
+//! Output image format of DrawTrueAndFalsePositives()
+struct DrawFormat{
+	std::string extension;
+	std::vector<int> params;	// parameters of cv::imwrite()
+	int thickness;
 
-	ofs << "file name,true positive,false positive,miss detect" << std::endl;
-	int num_plot = img_files.size();
-	for (int i = 0; i < num_plot; i++){
-		ofs << img_files[i] << "," << true_positives[i].size() << "," 
-			<< false_positives[i].size() << ","
-			<< ground_truth[i].size() - true_positives[i].size() << std::endl;
+	DrawFormat(const std::string& format = "png", int quality = -1, int thickness = 3)
+		: extension("." + format), thickness(thickness)
+	{
+		if (quality < 0)
+			return;
+		if (format == "png"){
+			params.push_back(cv::IMWRITE_PNG_COMPRESSION);
+			params.push_back(quality);
+		}
+		else if (format == "jpg" || format == "jpeg"){
+			params.push_back(cv::IMWRITE_JPEG_QUALITY);
+			params.push_back(quality);
+		}
 	}
-	std::cout << "Save summary file in " << output_file << " as CSV." << std::endl;
+};
 
-	return true;
+
+// save path of the index-th image: <index + 1>.<extension>
+std::string DrawSaveName(const boost::filesystem::path& dir_path, int index, const DrawFormat& format)
+{
+	std::stringstream str;
+	str << index + 1 << format.extension;
+	return (dir_path / boost::filesystem::path(str.str())).generic_string();
 }
 
 
-bool SaveRecallPrecisionCurve(const std::string& output_file, 
-	const std::vector<float>& recall, const std::vector<float>& precision, const std::vector<float>& thresholds)
+// draw the result of the index-th image and save it
+bool DrawTrueAndFalsePositives(const std::string& filename, const boost::filesystem::path& dir_path, int index,
+	util::Span<cv::Rect> true_positives, util::Span<cv::Rect> false_positives,
+	const DrawFormat& format)
 {
-	assert(recall.size() == precision.size());
-	assert(recall.size() == thresholds.size());
-
-	std::ofstream ofs(output_file);
-	if (!ofs.is_open())
+	cv::Mat img = cv::imread(filename);
+	std::cout << "Load " << filename << "...";
+	if (img.empty()){
+		std::cerr << "Error: Fail to load " << filename << std::endl;
 		return false;
-
-	ofs << "threshold,recall,precision" << std::endl;
-	int num_plot = recall.size();
-	for (int i = 0; i < num_plot; i++){
-		ofs << thresholds[i] << "," << recall[i] << "," << precision[i] << std::endl;
 	}
-	std::cout << "Save rp-curve in " << output_file << " as CSV: in order threshold, recall, and precision." << std::endl;
 
+	cv::Mat draw_img;
+	util::DrawTrueAndFalsePositive(img, draw_img, true_positives, false_positives, format.thickness);
+
+	std::string save_name = DrawSaveName(dir_path, index, format);
+	bool write_ret = cv::imwrite(save_name, draw_img, format.params);
+	if (!write_ret){
+		std::cerr << "Error: Fail to save " << save_name << std::endl;
+		return false;
+	}
+	std::cout << "Save as " << save_name << std::endl;
+	util::ProfileCount(util::COUNT_IMAGES_DRAWN);
 	return true;
 }
 
 
+// Decode, draw and encode run as a pipeline, each stage on its own threads.
+// Queues between the stages are bounded, so only a few images are in memory.
 bool DrawTrueAndFalsePositives(const std::vector<std::string>& filenames, const std::string& output_folder,
-	const std::vector<std::vector<cv::Rect>>& true_positives, const std::vector<std::vector<cv::Rect>>& false_positives,
-	int thickness)
+	const util::FlatList<cv::Rect>& true_positives, const util::FlatList<cv::Rect>& false_positives,
+	const DrawFormat& format, int num_threads)
 {
 	assert(filenames.size() == true_positives.size());
 	assert(filenames.size() == false_positives.size());
 
 	using namespace boost::filesystem;
+	util::ScopedTimer timer("DrawTrueAndFalsePositives");
 
 	path dir_path(output_folder);
 	if (!is_directory(dir_path)){
@@ -188,33 +309,604 @@ bool DrawTrueAndFalsePositives(const std::vector<std::string>& filenames, const
 		return false;
 	}
 
+	if (num_threads == 0)
+		num_threads = util::hardware_threads();
+	if (num_threads < 1)
+		num_threads = 1;
+
+	typedef std::pair<int, cv::Mat> Item;
+	util::BoundedQueue<Item> decoded(2 * num_threads), drawn(2 * num_threads);
+	std::mutex log_mutex;
+	std::atomic<int> next_image(0);
 	int N = filenames.size();
-	for (int i = 0; i < N; i++){
-		cv::Mat img = cv::imread(filenames[i]);
-		std::cout << "Load " << filenames[i] << "...";
-		if (img.empty()){
-			std::cerr << "Error: Fail to load " << filenames[i] << std::endl;
-			continue;
+
+	auto decode = [&](){
+		for (int i = next_image++; i < N; i = next_image++){
+			cv::Mat img = cv::imread(filenames[i]);
+			if (img.empty()){
+				std::lock_guard<std::mutex> lock(log_mutex);
+				std::cerr << "Error: Fail to load " << filenames[i] << std::endl;
+				continue;
+			}
+			decoded.push(Item(i, img));
+		}
+	};
+	auto draw = [&](){
+		Item item;
+		while (decoded.pop(item)){
+			cv::Mat draw_img;
+			util::DrawTrueAndFalsePositive(item.second, draw_img, true_positives[item.first], false_positives[item.first], format.thickness);
+			drawn.push(Item(item.first, draw_img));
 		}
+	};
+	auto encode = [&](){
+		Item item;
+		while (drawn.pop(item)){
+			std::string save_name = DrawSaveName(dir_path, item.first, format);
+			bool write_ret = cv::imwrite(save_name, item.second, format.params);
+			std::lock_guard<std::mutex> lock(log_mutex);
+			if (!write_ret){
+				std::cerr << "Error: Fail to save " << save_name << std::endl;
+				continue;
+			}
+			std::cout << "Load " << filenames[item.first] << "...Save as " << save_name << std::endl;
+			util::ProfileCount(util::COUNT_IMAGES_DRAWN);
+		}
+	};
+
+	// drawing is cheap, so it gets one thread
+	std::vector<std::thread> decoders, encoders;
+	for (int t = 0; t < num_threads; t++){
+		decoders.push_back(std::thread(decode));
+		encoders.push_back(std::thread(encode));
+	}
+	std::thread drawer(draw);
 
-		cv::Mat draw_img;
-		util::DrawTrueAndFalsePositive(img, draw_img, true_positives[i], false_positives[i], thickness);
+	for (int t = 0; t < num_threads; t++)
+		decoders[t].join();
+	decoded.close();
+	drawer.join();
+	drawn.close();
+	for (int t = 0; t < num_threads; t++)
+		encoders[t].join();
 
-		std::stringstream str;
-		str << i + 1 << ".png";
-		path save_path = dir_path / path(str.str());
-		std::string save_name = save_path.generic_string();
-		bool write_ret = cv::imwrite(save_name, draw_img);
-		if (!write_ret){
-			std::cerr << "Error: Fail to save " << save_name << std::endl;
-			continue;
+	return true;
+}
+
+
+// p-th quantile (0-1) of sorted values by linear interpolation
+float Percentile(const std::vector<float>& sorted_values, float p)
+{
+	if (sorted_values.empty())
+		return 0;
+	float pos = std::min(std::max(p, 0.0f), 1.0f) * (sorted_values.size() - 1);
+	int i = (int)pos;
+	if (i + 1 >= sorted_values.size())
+		return sorted_values.back();
+	return sorted_values[i] + (pos - i) * (sorted_values[i + 1] - sorted_values[i]);
+}
+
+
+// Save a recall-precision curve, thinned out by DecimateCurve() if rp_points or rp_error is given
+bool SaveCurve(const std::string& rp_file, std::vector<float>& recall, std::vector<float>& precision,
+	std::vector<float>& thresholds, int rp_points, float rp_error)
+{
+	if (rp_points > 0 || rp_error > 0)
+		eval::DecimateCurve(recall, precision, thresholds, rp_error, rp_points);
+	return util::SaveRecallPrecisionCurve(rp_file, recall, precision, thresholds, eval::GetNumThreads());
+}
+
+
+// Save the recall-precision curves of all classes in one CSV, each thinned out as SaveCurve()
+bool SaveClassCurves(const std::string& rp_file, std::vector<eval::ClassResult>& classes, int rp_points, float rp_error)
+{
+	util::TextWriter writer;
+	if (!writer.open(rp_file))
+		return false;
+
+	writer << "class,threshold,recall,precision\n";
+	for (int c = 0; c < classes.size(); c++){
+		eval::ClassResult& result = classes[c];
+		if (rp_points > 0 || rp_error > 0)
+			eval::DecimateCurve(result.recall, result.precision, result.thresholds, rp_error, rp_points);
+		for (int i = 0; i < result.recall.size(); i++){
+			writer << result.label << ',' << result.thresholds[i] << ',' << result.recall[i] << ',' << result.precision[i] << '\n';
+		}
+	}
+	if (!writer.close())
+		return false;
+	std::cout << "Save rp-curves in " << rp_file << " as CSV: in order class, threshold, recall, and precision." << std::endl;
+	return true;
+}
+
+
+// Evaluate image by image, reading the three files in lockstep.
+// Only (score, true positive) pairs are kept for the recall-precision curve.
+int EvaluateStream(const std::string& local_file, const std::string& ground_truth, const std::string& score_file,
+	float thresh, float overlap_th, const std::string& output_file, const std::string& rp_file,
+	int rp_points, float rp_error, const std::string& output_dir, const DrawFormat& draw_format,
+	const std::string& true_pos_file, const std::string& false_pos_file)
+{
+	util::ScopedTimer timer("EvaluateStream");
+	util::AnnotationReader local_reader, gt_reader;
+	util::ScoreReader score_reader;
+	if (!local_reader.open(local_file)){
+		std::cerr << "Fail to load " << local_file << std::endl;
+		return -1;
+	}
+	if (!gt_reader.open(ground_truth)){
+		std::cerr << "Fail to load " << ground_truth << std::endl;
+		return -1;
+	}
+	bool use_score = !score_file.empty();
+	if (use_score && !score_reader.open(score_file)){
+		std::cerr << "Fail to load " << score_file << std::endl;
+		return -1;
+	}
+
+	util::TextWriter summary_writer;
+	if (!summary_writer.open(output_file)){
+		std::cerr << "Error: Fail to save summary file " << output_file << std::endl;
+		return -1;
+	}
+	util::WriteSummaryHeader(summary_writer);
+
+	util::TextWriter true_pos_writer, false_pos_writer;
+	if (!true_pos_file.empty() && !true_pos_writer.open(true_pos_file))
+		std::cerr << "Error: Fail to save true positive file " << true_pos_file << std::endl;
+	if (!false_pos_file.empty() && !false_pos_writer.open(false_pos_file))
+		std::cerr << "Error: Fail to save false positive file " << false_pos_file << std::endl;
+
+	boost::filesystem::path dir_path(output_dir);
+	bool draw = !output_dir.empty() && boost::filesystem::is_directory(dir_path);
+	if (!output_dir.empty() && !draw)
+		std::cerr << "Error: " << output_dir << " is not a directory.";
+
+	std::string img_file, gt_img_file;
+	std::vector<cv::Rect> positions, gt_positions, true_positives, false_positives;
+	std::vector<float> scores, overlap_score;
+	std::vector<int> binded_index, true_positive_id, false_positive_id;
+	std::vector<eval::ScoredDetection> detections;
+	int ground_truth_num = 0;
+	int index = 0;
+	for (; local_reader.read(img_file, positions); index++){
+		if (!gt_reader.read(gt_img_file, gt_positions)){
+			std::cerr << "Error: " << ground_truth << " has fewer images than " << local_file << std::endl;
+			return -1;
+		}
+		if (local_reader.labeled() || gt_reader.labeled()){
+			std::cerr << "Error: class ids cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		if (use_score && (!score_reader.read(scores) || scores.size() != positions.size())){
+			std::cerr << "Error: scores of image " << index + 1 << " do not match " << local_file << std::endl;
+			return -1;
+		}
+
+		true_positive_id.clear();
+		false_positive_id.clear();
+		if (use_score){
+			eval::bindRectPairs(positions, gt_positions, scores, binded_index, overlap_score, overlap_th);
+			eval::EvaluateDetection(binded_index, scores, overlap_score, true_positive_id, false_positive_id, thresh, overlap_th);
+			eval::CollectScoredDetections(binded_index, scores, overlap_score, detections);
+		}
+		else{
+			eval::bindRectPairs(positions, gt_positions, binded_index, overlap_score);
+			eval::EvaluateDetection(binded_index, overlap_score, true_positive_id, false_positive_id, overlap_th);
+		}
+		ground_truth_num += gt_positions.size();
+		eval::Id2Positions(positions, true_positive_id, true_positives);
+		eval::Id2Positions(positions, false_positive_id, false_positives);
+
+		util::WriteSummaryLine(summary_writer, img_file, gt_positions, true_positives, false_positives);
+		if (true_pos_writer.is_open())
+			util::WriteAnnotationLine(true_pos_writer, img_file, true_positives);
+		if (false_pos_writer.is_open())
+			util::WriteAnnotationLine(false_pos_writer, img_file, false_positives);
+		if (draw)
+			DrawTrueAndFalsePositives(img_file, dir_path, index, true_positives, false_positives, draw_format);
+	}
+	if (score_reader.error_line() > 0){
+		std::cerr << "Error: illegal format at line " << score_reader.error_line()
+			<< " in " << score_file << std::endl;
+		return -1;
+	}
+	if (!summary_writer.close()){
+		std::cerr << "Error: Fail to save summary file " << output_file << std::endl;
+		return -1;
+	}
+	std::cout << "Save summary file in " << output_file << " as CSV." << std::endl;
+
+	// save recall precision
+	if (use_score && !rp_file.empty()){
+		std::vector<float> recall, precision, thresholds;
+		float ap = eval::RecallPrecision(detections, ground_truth_num, recall, precision, thresholds);
+		if (!SaveCurve(rp_file, recall, precision, thresholds, rp_points, rp_error)){
+			std::cerr << "Error: Fail to save rp-curve in " << rp_file << std::endl;
+		}
+		std::cout << "Average Precision: " << ap;
+	}
+
+	return 0;
+}
+
+
+// hash of the last bytes of a file before offset, to find out whether the file was rewritten
+static bool TailHash(const std::string& filename, unsigned long long offset, unsigned long long* hash)
+{
+	const unsigned long long tail_bytes = 4096;
+	return util::HashFileRange(filename, offset - std::min(offset, tail_bytes), offset, hash);
+}
+
+
+// Evaluate only the images appended to the three files since the run that saved state_file,
+// and merge them into the counts and the (score, true positive) stream of the earlier images.
+// Images are taken while all the files have a complete line for them.
+int EvaluateIncremental(const std::string& local_file, const std::string& ground_truth, const std::string& score_file,
+	float thresh, float overlap_th, const std::string& output_file, const std::string& rp_file,
+	int rp_points, float rp_error, const std::string& state_file)
+{
+	util::ScopedTimer timer("EvaluateIncremental");
+	bool use_score = !score_file.empty();
+	const std::string* files[3] = { &local_file, &ground_truth, &score_file };
+	int file_num = use_score ? 3 : 2;
+
+	util::EvaluationState state;
+	bool resumed = util::LoadEvaluationState(state_file, state);
+	if (resumed){
+		bool same = state.score_threshold == thresh && state.overlap_threshold == overlap_th &&
+			state.flags == (use_score ? util::STATE_HAS_SCORE : 0);
+		for (int f = 0; f < file_num && same; f++){
+			unsigned long long hash;
+			same = TailHash(*files[f], state.consumed[f], &hash) && hash == state.tail_hash[f];
+		}
+		if (!same){
+			std::cerr << "Warning: " << state_file << " does not match the input files or options; "
+				<< "evaluate from the beginning" << std::endl;
+			resumed = false;
+		}
+	}
+	if (!resumed){
+		state.clear();
+		state.score_threshold = thresh;
+		state.overlap_threshold = overlap_th;
+		state.flags = use_score ? util::STATE_HAS_SCORE : 0;
+	}
+
+	// new lines of the three files
+	util::AnnotationList local_list, gt_list;
+	util::ScoreList score_list;
+	std::vector<unsigned long long> line_ends[3];
+	if (!util::LoadAnnotationTail(local_file, state.consumed[0], local_list, line_ends[0])){
+		std::cerr << "Fail to load " << local_file << std::endl;
+		return -1;
+	}
+	if (!util::LoadAnnotationTail(ground_truth, state.consumed[1], gt_list, line_ends[1])){
+		std::cerr << "Fail to load " << ground_truth << std::endl;
+		return -1;
+	}
+	if (use_score && !util::LoadScoreTail(score_file, state.consumed[2], score_list, line_ends[2])){
+		std::cerr << "Fail to load " << score_file << std::endl;
+		return -1;
+	}
+
+	if (local_list.has_labels() || gt_list.has_labels()){
+		std::cerr << "Error: class ids cannot be used with --state." << std::endl;
+		return -1;
+	}
+
+	int N = std::min(local_list.size(), gt_list.size());
+	if (use_score)
+		N = std::min(N, score_list.size());
+	local_list.imgpathlist.resize(N);
+	local_list.offsets.resize(N + 1);
+	local_list.rects.resize(local_list.offsets.back());
+	gt_list.imgpathlist.resize(N);
+	gt_list.offsets.resize(N + 1);
+	gt_list.rects.resize(gt_list.offsets.back());
+	if (use_score){
+		score_list.offsets.resize(N + 1);
+		score_list.scores.resize(score_list.offsets.back());
+	}
+	if (gt_list.imgpathlist != local_list.imgpathlist){
+		std::cerr << "Warning: image paths of " << ground_truth << " and " << local_file << " differ" << std::endl;
+	}
+
+	std::vector<std::string> img_files;
+	util::FlatList<cv::Rect> positions, gt_positions;
+	util::FlatList<float> scores;
+	img_files.swap(local_list.imgpathlist);
+	positions.data.swap(local_list.rects);
+	positions.offsets.swap(local_list.offsets);
+	gt_positions.data.swap(gt_list.rects);
+	gt_positions.offsets.swap(gt_list.offsets);
+	if (use_score){
+		scores.data.swap(score_list.scores);
+		scores.offsets.swap(score_list.offsets);
+		if (scores.offsets != positions.offsets){
+			std::cerr << "Error: scores in " << score_file << " do not match " << local_file << std::endl;
+			return -1;
+		}
+	}
+
+	util::FlatList<int> binded_index, true_positive_id, false_positive_id;
+	util::FlatList<float> overlap_score;
+	int ground_truth_num;
+	eval::bindRectPairs(positions, gt_positions, scores, binded_index, overlap_score, &ground_truth_num, overlap_th);
+	eval::EvaluateDetection(binded_index, scores, overlap_score, true_positive_id, false_positive_id, thresh, overlap_th);
+
+	// merge into the state
+	for (int n = 0; n < N; n++){
+		int true_positive_num = true_positive_id.count(n);
+		state.img_files.push_back(img_files[n]);
+		state.counts.push_back(true_positive_num);
+		state.counts.push_back(false_positive_id.count(n));
+		state.counts.push_back(gt_positions.count(n) - true_positive_num);
+	}
+	state.ground_truth_num += ground_truth_num;
+	for (int f = 0; f < file_num; f++){
+		if (N > 0)
+			state.consumed[f] = line_ends[f][N - 1];
+		TailHash(*files[f], state.consumed[f], &state.tail_hash[f]);
+	}
+
+	std::vector<eval::ScoredDetection> detections;
+	if (use_score){
+		std::vector<eval::ScoredDetection> added;
+		eval::CollectScoredDetections(binded_index, scores, overlap_score, added);
+		detections.resize(state.scores.size());
+		for (size_t i = 0; i < detections.size(); i++){
+			detections[i].score = state.scores[i];
+			detections[i].true_positive = state.true_positives[i] != 0;
+		}
+		eval::MergeScoredDetections(detections, added);
+		state.scores.resize(detections.size());
+		state.true_positives.resize(detections.size());
+		for (size_t i = 0; i < detections.size(); i++){
+			state.scores[i] = detections[i].score;
+			state.true_positives[i] = detections[i].true_positive ? 1 : 0;
+		}
+	}
+
+	if (!util::SaveEvaluationState(state_file, state)){
+		std::cerr << "Error: Fail to save state file " << state_file << std::endl;
+		return -1;
+	}
+	std::cout << "Evaluate " << N << " new images (" << state.img_files.size() << " in total)." << std::endl;
+
+	if (!util::SaveSummary(output_file, state.img_files, state.counts)){
+		std::cerr << "Error: Fail to save summary file " << output_file << std::endl;
+	}
+
+	// save recall precision
+	if (use_score && !rp_file.empty()){
+		std::vector<float> recall, precision, thresholds;
+		float ap = eval::RecallPrecision(detections, state.ground_truth_num, recall, precision, thresholds);
+		if (!SaveCurve(rp_file, recall, precision, thresholds, rp_points, rp_error)){
+			std::cerr << "Error: Fail to save rp-curve in " << rp_file << std::endl;
+		}
+		std::cout << "Average Precision: " << ap;
+	}
+
+	return 0;
+}
+
+
+// Ground truth of the server mode, loaded once
+struct ServedGroundTruth{
+	std::vector<std::string> img_files;
+	util::FlatList<cv::Rect> positions;
+	std::unordered_map<std::string, int> index;		// image path to image
+};
+
+
+// read n lines of a request into text
+static void ReadRequestLines(std::istream& is, int n, std::string& text)
+{
+	text.clear();
+	std::string line;
+	for (int i = 0; i < n && std::getline(is, line); i++){
+		text += line;
+		text += '\n';
+	}
+}
+
+
+// Evaluate one batch of the server mode and write the reply, false with error_message on a broken batch.
+// Images are matched to the ground truth by path: images of the ground truth missing from the batch have
+// no detections, and images missing from the ground truth have no objects.
+static bool EvaluateBatch(const util::AnnotationList& detections, const util::ScoreList& detection_scores,
+	ServedGroundTruth& gt, float thresh, float overlap_th, int rp_points, float rp_error,
+	std::ostream& os, std::string& error_message)
+{
+	util::ScopedTimer timer("EvaluateBatch");
+	int G = gt.img_files.size();
+	int N = detections.size();
+	std::vector<int> image_of(N);
+	std::vector<char> seen(G, 0);
+	int extra = 0;
+	for (int n = 0; n < N; n++){
+		std::unordered_map<std::string, int>::const_iterator it = gt.index.find(detections.imgpathlist[n]);
+		if (it == gt.index.end()){
+			image_of[n] = G + extra++;
+		}
+		else if (seen[it->second]){
+			error_message = "image " + detections.imgpathlist[n] + " appears twice";
+			return false;
+		}
+		else{
+			seen[it->second] = 1;
+			image_of[n] = it->second;
 		}
-		std::cout << "Save as " << save_name << std::endl;
 	}
+
+	// detections in the order of the ground truth, images not in the ground truth after them
+	util::FlatList<cv::Rect> positions;
+	util::FlatList<float> scores;
+	positions.offsets.assign(G + extra + 1, 0);
+	for (int n = 0; n < N; n++)
+		positions.offsets[image_of[n] + 1] = detections.offsets[n + 1] - detections.offsets[n];
+	for (int i = 0; i < G + extra; i++)
+		positions.offsets[i + 1] += positions.offsets[i];
+	positions.data.resize(positions.offsets.back());
+	scores.reshape(positions);
+	for (int n = 0; n < N; n++){
+		std::copy(detections.rects.begin() + detections.offsets[n], detections.rects.begin() + detections.offsets[n + 1],
+			positions.at(image_of[n]));
+		std::copy(detection_scores.scores.begin() + detection_scores.offsets[n],
+			detection_scores.scores.begin() + detection_scores.offsets[n + 1], scores.at(image_of[n]));
+	}
+	gt.positions.offsets.resize(G + 1);
+	for (int i = 0; i < extra; i++)
+		gt.positions.offsets.push_back(gt.positions.offsets.back());
+
+	util::FlatList<int> binded_index, true_positive_id, false_positive_id;
+	util::FlatList<float> overlap_score;
+	int ground_truth_num;
+	eval::bindRectPairs(positions, gt.positions, scores, binded_index, overlap_score, &ground_truth_num, overlap_th);
+	eval::EvaluateDetection(binded_index, scores, overlap_score, true_positive_id, false_positive_id, thresh, overlap_th);
+
+	std::vector<eval::ScoredDetection> scored_detections;
+	std::vector<float> recall, precision, thresholds;
+	eval::CollectScoredDetections(binded_index, scores, overlap_score, scored_detections);
+	float ap = eval::RecallPrecision(scored_detections, ground_truth_num, recall, precision, thresholds);
+	if (rp_points > 0 || rp_error > 0)
+		eval::DecimateCurve(recall, precision, thresholds, rp_error, rp_points);
+
+	int true_positive_num = true_positive_id.data.size();
+	os << "OK " << N << " " << positions.data.size() << "\n";
+	os << "AP " << ap << "\n";
+	os << "SUMMARY " << true_positive_num << " " << false_positive_id.data.size() << " "
+		<< ground_truth_num - true_positive_num << "\n";
+	os << "CURVE " << recall.size() << "\n";
+	for (int i = 0; i < recall.size(); i++){
+		os << thresholds[i] << "," << recall[i] << "," << precision[i] << "\n";
+	}
+	os.flush();
 	return true;
 }
 
 
+// Protocol of the server mode, one text line per command:
+//   EVAL <image num>   followed by <image num> lines of a localization file
+//                      and <image num> lines of a score file
+//   QUIT               end of the session
+// Reply to EVAL:
+//   OK <image num> <detection num>
+//   AP <average precision>
+//   SUMMARY <true positive> <false positive> <miss detect>
+//   CURVE <point num>  followed by <point num> lines of "threshold,recall,precision"
+// or one line of "ERROR <message>".
+static void ServeSession(std::istream& is, std::ostream& os, ServedGroundTruth& gt,
+	float thresh, float overlap_th, int rp_points, float rp_error)
+{
+	std::string line, text;
+	util::AnnotationList detections;
+	util::ScoreList scores;
+	while (std::getline(is, line)){
+		std::istringstream command(line);
+		std::string name;
+		int n = -1;
+		command >> name;
+		if (name.empty())
+			continue;
+		if (name == "QUIT")
+			break;
+		if (name != "EVAL" || !(command >> n) || n < 0){
+			os << "ERROR unknown command: " << line << std::endl;
+			continue;
+		}
+
+		// both blocks are read before checking them, so a broken batch does not break the session
+		detections = util::AnnotationList();
+		scores = util::ScoreList();
+		int error_line = 0;
+		ReadRequestLines(is, n, text);
+		util::ParseAnnotationText(text.data(), text.data() + text.size(), detections);
+		ReadRequestLines(is, n, text);
+		bool score_ok = util::ParseScoreText(text.data(), text.data() + text.size(), scores, &error_line);
+
+		std::string error_message;
+		if (detections.size() != n)
+			error_message = "expected " + std::to_string(n) + " lines of localization";
+		else if (!score_ok)
+			error_message = "illegal score at line " + std::to_string(error_line);
+		else if (scores.offsets != detections.offsets)
+			error_message = "scores do not match localization";
+		else if (detections.has_labels())
+			error_message = "class ids are not supported in server mode";
+		if (!error_message.empty() ||
+			!EvaluateBatch(detections, scores, gt, thresh, overlap_th, rp_points, rp_error, os, error_message)){
+			os << "ERROR " << error_message << std::endl;
+		}
+	}
+}
+
+
+// Load the ground truth once and evaluate batches from stdin, or from each connection to socket_path
+int Serve(const std::string& ground_truth, const std::string& socket_path,
+	float thresh, float overlap_th, int rp_points, float rp_error)
+{
+	util::AnnotationList gt_list;
+	if (!util::LoadAnnotationFile(ground_truth, gt_list, eval::GetNumThreads())){
+		std::cerr << "Fail to load " << ground_truth << std::endl;
+		return -1;
+	}
+	if (gt_list.has_labels()){
+		std::cerr << "Error: class ids in " << ground_truth << " are not supported in server mode." << std::endl;
+		return -1;
+	}
+	ServedGroundTruth gt;
+	gt.img_files.swap(gt_list.imgpathlist);
+	gt.positions.data.swap(gt_list.rects);
+	gt.positions.offsets.swap(gt_list.offsets);
+	for (int i = 0; i < gt.img_files.size(); i++){
+		if (!gt.index.insert(std::make_pair(gt.img_files[i], i)).second){
+			std::cerr << "Error: image " << gt.img_files[i] << " appears twice in " << ground_truth << std::endl;
+			return -1;
+		}
+	}
+
+	if (socket_path.empty()){
+		ServeSession(std::cin, std::cout, gt, thresh, overlap_th, rp_points, rp_error);
+		return 0;
+	}
+
+#ifdef BOOST_ASIO_HAS_LOCAL_SOCKETS
+	try{
+		// a socket left by an earlier server is replaced, any other file is kept
+		boost::filesystem::file_status status = boost::filesystem::symlink_status(socket_path);
+		if (status.type() == boost::filesystem::socket_file)
+			boost::filesystem::remove(socket_path);
+		else if (status.type() != boost::filesystem::file_not_found){
+			std::cerr << "Error: " << socket_path << " exists and is not a socket." << std::endl;
+			return -1;
+		}
+		boost::asio::io_service io_service;
+		boost::asio::local::stream_protocol::acceptor acceptor(io_service,
+			boost::asio::local::stream_protocol::endpoint(socket_path));
+		std::cerr << "Serve " << ground_truth << " on " << socket_path << std::endl;
+		while (true){
+			boost::asio::local::stream_protocol::iostream stream;
+#if BOOST_VERSION >= 106600
+			acceptor.accept(stream.socket());
+#else
+			acceptor.accept(*stream.rdbuf());
+#endif
+			ServeSession(stream, stream, gt, thresh, overlap_th, rp_points, rp_error);
+		}
+	}
+	catch (std::exception& e){
+		std::cerr << "Error: " << e.what() << std::endl;
+		return -1;
+	}
+#else
+	std::cerr << "Error: Unix domain sockets are not available; use --serve with stdin." << std::endl;
+	return -1;
+#endif
+}
+
+
 int main(int argc, char * argv[])
 {
 #ifdef _DEBUG
@@ -226,71 +918,349 @@ int main(int argc, char * argv[])
 	std::string local_file, ground_truth, output_file, rp_file,
 		score_file, true_pos_file, false_pos_file, output_dir;
 	float thresh, overlap_th;
+	int num_threads;
+	bool stream, join;
+	int bootstrap;
+	unsigned int bootstrap_seed;
+	float confidence;
+	bool all_point;
+	int rp_points;
+	float rp_error;
+	std::vector<float> overlap_ths;
+	std::string map_file, draw_format, profile_file, cache_file, state_file, socket_path;
+	std::string difficult_file, region_file;
+	bool serve, fused;
+	int draw_quality;
 	if (!ParseCommandLine(argc, argv, local_file, ground_truth, output_file,
-		score_file, &thresh, &overlap_th, rp_file, output_dir, true_pos_file, false_pos_file))
+		score_file, &thresh, &overlap_th, rp_file, output_dir, true_pos_file, false_pos_file, &num_threads, &stream,
+		overlap_ths, map_file, draw_format, &draw_quality, profile_file, &join,
+		&bootstrap, &bootstrap_seed, &confidence, cache_file, state_file, &all_point, &rp_points, &rp_error,
+		&serve, socket_path, difficult_file, region_file, &fused))
 		return -1;
+	eval::SetNumThreads(num_threads);
+	eval::SetAveragePrecisionMode(all_point ? eval::AP_ALL_POINT : eval::AP_11_POINT);
+	util::EnableProfile(!profile_file.empty());
 
-	std::vector<std::string> img_files;
-	std::vector<std::vector<cv::Rect>> positions;
-	if (!util::LoadAnnotationFile(local_file, img_files, positions)){
-		std::cerr << "Fail to load " << local_file << std::endl;
+	// difficult ground truth and ignore regions are matched with the whole data set in memory
+	bool use_ignore = !difficult_file.empty() || !region_file.empty();
+	if (use_ignore && (serve || stream || !state_file.empty())){
+		std::cerr << "Error: --difficult and --ignore cannot be used with --serve, --stream or --state." << std::endl;
+		return -1;
+	}
+	if (use_ignore && (!overlap_ths.empty() || bootstrap > 0 || !cache_file.empty())){
+		std::cerr << "Error: '-m', --bootstrap and --cache cannot be used with --difficult or --ignore." << std::endl;
 		return -1;
 	}
 
-	std::vector<std::string> gt_img_files;
-	std::vector<std::vector<cv::Rect>> gt_positions;
-	if (!util::LoadAnnotationFile(ground_truth, gt_img_files, gt_positions)){
-		std::cerr << "Fail to load " << ground_truth << std::endl;
+	if (serve){
+		if (fused){
+			std::cerr << "Error: --fused cannot be used with --serve." << std::endl;
+			return -1;
+		}
+		int ret = Serve(ground_truth, socket_path, thresh, overlap_th, rp_points, rp_error);
+		if (!profile_file.empty())
+			util::SaveProfile(profile_file);
+		return ret;
+	}
+
+	// scores in the localization file are read with the rectangles
+	if (fused && !score_file.empty()){
+		std::cerr << "Error: '-s' cannot be used with --fused." << std::endl;
+		return -1;
+	}
+	if (fused && (stream || !state_file.empty())){
+		std::cerr << "Error: --fused cannot be used with --stream or --state." << std::endl;
 		return -1;
 	}
 
-	std::vector<std::vector<float>> scores;
+	// a binary localization file may carry its scores
+	if (!fused && score_file.empty() && util::HasBinaryScores(local_file))
+		score_file = local_file;
+
+	if (stream){
+		if (util::IsBinaryAnnotationFile(local_file) || util::IsBinaryAnnotationFile(ground_truth)){
+			std::cerr << "Error: --stream reads text files only." << std::endl;
+			return -1;
+		}
+		if (!overlap_ths.empty()){
+			std::cerr << "Error: '-m' cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		if (join){
+			std::cerr << "Error: --join cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		if (bootstrap > 0){
+			std::cerr << "Error: --bootstrap cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		if (!cache_file.empty()){
+			std::cerr << "Error: --cache cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		if (!state_file.empty()){
+			std::cerr << "Error: --state cannot be used with --stream." << std::endl;
+			return -1;
+		}
+		int ret = EvaluateStream(local_file, ground_truth, score_file, thresh, overlap_th,
+			output_file, rp_file, rp_points, rp_error, output_dir, DrawFormat(draw_format, draw_quality),
+			true_pos_file, false_pos_file);
+		if (!profile_file.empty()){
+			std::cout << std::endl;
+			util::SaveProfile(profile_file);
+		}
+		return ret;
+	}
+
+	if (!state_file.empty()){
+		if (util::IsBinaryAnnotationFile(local_file) || util::IsBinaryAnnotationFile(ground_truth) ||
+			(!score_file.empty() && util::IsBinaryAnnotationFile(score_file))){
+			std::cerr << "Error: --state reads text files only." << std::endl;
+			return -1;
+		}
+		// the state keeps counts of each image, not rectangles
+		if (!true_pos_file.empty() || !false_pos_file.empty() || !output_dir.empty()){
+			std::cerr << "Error: '-t', '-f' and '-d' cannot be used with --state." << std::endl;
+			return -1;
+		}
+		if (!overlap_ths.empty() || bootstrap > 0 || join || !cache_file.empty()){
+			std::cerr << "Error: '-m', --bootstrap, --join and --cache cannot be used with --state." << std::endl;
+			return -1;
+		}
+		int ret = EvaluateIncremental(local_file, ground_truth, score_file, thresh, overlap_th,
+			output_file, rp_file, rp_points, rp_error, state_file);
+		if (!profile_file.empty()){
+			std::cout << std::endl;
+			util::SaveProfile(profile_file);
+		}
+		return ret;
+	}
+
+	// whole data set in flat buffers
+	util::AnnotationList local_list, gt_list;
+	util::ScoreList score_list;
+	bool use_score = fused || !score_file.empty();
+	if (fused ? !util::LoadFusedAnnotationFile(local_file, local_list, score_list, num_threads) :
+		!util::LoadAnnotationFile(local_file, local_list, num_threads)){
+		std::cerr << "Fail to load " << local_file << std::endl;
+		return -1;
+	}
+	if (!util::LoadAnnotationFile(ground_truth, gt_list, num_threads)){
+		std::cerr << "Fail to load " << ground_truth << std::endl;
+		return -1;
+	}
+	if (!difficult_file.empty() && !util::LoadDifficultFile(difficult_file, gt_list)){
+		std::cerr << "Fail to load " << difficult_file << std::endl;
+		return -1;
+	}
+	if (!region_file.empty() && !util::LoadIgnoreRegionFile(region_file, gt_list)){
+		std::cerr << "Fail to load " << region_file << std::endl;
+		return -1;
+	}
 	if (!score_file.empty()){
-		if (!util::LoadScoreFile(score_file, scores)){
+		if (!util::LoadScoreFile(score_file, score_list, num_threads)){
 			std::cerr << "Fail to load " << score_file << std::endl;
 			return -1;
 		}
 	}
-	
+
+	if (join){
+		int detection_only, ground_truth_only;
+		if (!util::JoinByImagePath(local_list, use_score ? &score_list : 0, gt_list, &detection_only, &ground_truth_only))
+			return -1;
+		if (detection_only > 0)
+			std::cerr << "Warning: " << detection_only << " images are not in " << ground_truth << std::endl;
+		if (ground_truth_only > 0)
+			std::cerr << "Warning: " << ground_truth_only << " images are not in " << local_file << std::endl;
+	}
+	else if (gt_list.size() != local_list.size()){
+		std::cerr << "Error: " << ground_truth << " and " << local_file << " have different numbers of images" << std::endl;
+		return -1;
+	}
+	else if (gt_list.imgpathlist != local_list.imgpathlist){
+		std::cerr << "Warning: image paths of " << ground_truth << " and " << local_file
+			<< " differ; use --join to match them by path" << std::endl;
+	}
+
+	// class ids on either side evaluate each class; a side without them is all class 0
+	bool multi_class = local_list.has_labels() || gt_list.has_labels();
+	if (multi_class && (!overlap_ths.empty() || bootstrap > 0 || !cache_file.empty())){
+		std::cerr << "Error: '-m', --bootstrap and --cache cannot be used with class ids." << std::endl;
+		return -1;
+	}
+
+	std::vector<std::string> img_files;
+	util::FlatList<cv::Rect> positions, gt_positions;
+	util::FlatList<int> labels, gt_labels;
+	util::FlatList<float> scores;
+	img_files.swap(local_list.imgpathlist);
+	positions.data.swap(local_list.rects);
+	positions.offsets.swap(local_list.offsets);
+	gt_positions.data.swap(gt_list.rects);
+	gt_positions.offsets.swap(gt_list.offsets);
+	if (multi_class){
+		labels.offsets = positions.offsets;
+		labels.data.swap(local_list.labels);
+		labels.data.resize(positions.data.size(), 0);
+		gt_labels.offsets = gt_positions.offsets;
+		gt_labels.data.swap(gt_list.labels);
+		gt_labels.data.resize(gt_positions.data.size(), 0);
+	}
+	eval::GroundTruthIgnore ignore;
+	if (!gt_list.difficult.empty()){
+		ignore.difficult.data.swap(gt_list.difficult);
+		ignore.difficult.offsets = gt_positions.offsets;
+	}
+	if (!gt_list.ignore_offsets.empty()){
+		ignore.regions.data.swap(gt_list.ignore_regions);
+		ignore.regions.offsets.swap(gt_list.ignore_offsets);
+	}
+	if (use_score){
+		scores.data.swap(score_list.scores);
+		scores.offsets.swap(score_list.offsets);
+		if (scores.offsets != positions.offsets){
+			std::cerr << "Error: scores in " << score_file << " do not match " << local_file << std::endl;
+			return -1;
+		}
+	}
+
+	util::FlatList<int> binded_index, true_positive_id, false_positive_id;
+	util::FlatList<float> overlap_score;
+	int ground_truth_num;
+	std::vector<eval::ClassResult> classes;
+	float mean_class_ap = 0;
+	util::MatchCacheKey cache_key = {};
+	bool cached = false;
+	if (multi_class){
+		mean_class_ap = eval::EvaluateAll(positions, labels, gt_positions, gt_labels, ignore, scores, thresh,
+			true_positive_id, false_positive_id, classes, overlap_th);
+	}
+	else if (!cache_file.empty()){
+		// matching depends only on the contents of the input files and the overlap threshold
+		cache_key.overlap_threshold = overlap_th;
+		cache_key.flags = (join ? util::MATCH_CACHE_JOINED : 0) | (fused ? util::MATCH_CACHE_FUSED : 0);
+		if (!util::DigestFile(local_file, &cache_key.local) || !util::DigestFile(ground_truth, &cache_key.ground_truth) ||
+			(!score_file.empty() && !util::DigestFile(score_file, &cache_key.score))){
+			std::cerr << "Error: Fail to read input files for --cache" << std::endl;
+			return -1;
+		}
+		cached = util::LoadMatchCache(cache_file, cache_key, binded_index, overlap_score, &ground_truth_num) &&
+			binded_index.offsets == positions.offsets;
+	}
+	if (!multi_class && !cached){
+		eval::bindRectPairs(positions, gt_positions, scores, ignore, binded_index, overlap_score, &ground_truth_num, overlap_th);
+		if (!cache_file.empty() &&
+			!util::SaveMatchCache(cache_file, cache_key, binded_index, overlap_score, ground_truth_num)){
+			std::cerr << "Error: Fail to save match cache " << cache_file << std::endl;
+		}
+	}
+	if (!multi_class)
+		eval::EvaluateDetection(binded_index, scores, overlap_score, true_positive_id, false_positive_id, thresh, overlap_th);
+
+	util::FlatList<cv::Rect> true_positives, false_positives;
+	eval::Id2Positions(positions, true_positive_id, true_positives);
+	eval::Id2Positions(positions, false_positive_id, false_positives);
+
 	std::vector<float> recall, precision, thresholds;
-	std::vector<std::vector<cv::Rect>> true_positives, false_positives;
 	float ap = 0;
-	if (scores.empty()){
-		eval::EvaluateAll(positions, gt_positions, true_positives, false_positives, overlap_th);
-	}
-	else{
-		eval::EvaluateAll(positions, gt_positions, scores, thresh, recall, precision, thresholds, true_positives, false_positives, &ap, overlap_th);
+	if (!scores.empty() && !multi_class){
+		std::vector<eval::ScoredDetection> detections;
+		eval::CollectScoredDetections(binded_index, scores, overlap_score, detections);
+		ap = eval::RecallPrecision(detections, ground_truth_num, recall, precision, thresholds);
 	}
 
-	if (!SaveSummary(output_file, img_files, gt_positions, true_positives, false_positives)){
+	// difficult ground truth is not missed
+	util::FlatList<cv::Rect> counted_gt;
+	if (!ignore.difficult.data.empty()){
+		for (int n = 0; n < gt_positions.size(); n++){
+			for (int i = gt_positions.offsets[n]; i < gt_positions.offsets[n + 1]; i++){
+				if (!ignore.difficult.data[i])
+					counted_gt.data.push_back(gt_positions.data[i]);
+			}
+			counted_gt.offsets.push_back(counted_gt.data.size());
+		}
+	}
+	if (!util::SaveSummary(output_file, img_files, ignore.difficult.data.empty() ? gt_positions : counted_gt,
+		true_positives, false_positives, num_threads)){
 		std::cerr << "Error: Fail to save summary file " << output_file << std::endl;
 	}
 
+	util::FlatList<int> true_positive_labels, false_positive_labels;
+	if (multi_class){
+		util::gather(labels, true_positive_id, true_positive_labels);
+		util::gather(labels, false_positive_id, false_positive_labels);
+	}
+
 	if (!true_pos_file.empty()){
 		// save result annotation file
-		if (!util::SaveAnnotationFile(true_pos_file, img_files, true_positives))
+		if (!util::SaveAnnotationFile(true_pos_file, img_files, true_positives, true_positive_labels, " ", num_threads))
 			std::cerr << "Error: Fail to save true positive file " << true_pos_file << std::endl;;
 	}
 
 	if (!false_pos_file.empty()){
 		// save result annotation file
-		if (!util::SaveAnnotationFile(false_pos_file, img_files, false_positives))
+		if (!util::SaveAnnotationFile(false_pos_file, img_files, false_positives, false_positive_labels, " ", num_threads))
 			std::cerr << "Error: Fail to save false positive file " << false_pos_file << std::endl;
 	}
 
 	if (!output_dir.empty()){
 		// draw result on input images and save
-		DrawTrueAndFalsePositives(img_files, output_dir, true_positives, false_positives, 3);
+		DrawTrueAndFalsePositives(img_files, output_dir, true_positives, false_positives,
+			DrawFormat(draw_format, draw_quality), num_threads);
+	}
+
+	// average precision of each class
+	if (!scores.empty() && multi_class){
+		if (!rp_file.empty() && !SaveClassCurves(rp_file, classes, rp_points, rp_error)){
+			std::cerr << "Error: Fail to save rp-curves in " << rp_file << std::endl;
+		}
+		for (int c = 0; c < classes.size(); c++){
+			std::cout << "Average Precision (class " << classes[c].label << "): " << classes[c].average_precision << std::endl;
+		}
+		std::cout << "Mean Average Precision: " << mean_class_ap;
 	}
 
 	// save recall precision
-	if (!scores.empty() && !rp_file.empty()){
-		if (!SaveRecallPrecisionCurve(rp_file, recall, precision, thresholds)){
+	else if (!scores.empty() && !rp_file.empty()){
+		if (!SaveCurve(rp_file, recall, precision, thresholds, rp_points, rp_error)){
 			std::cerr << "Error: Fail to save rp-curve in " << rp_file << std::endl;
 		}
 		std::cout << "Average Precision: " << ap;
 	}
 
+	// average precision over several overlap thresholds
+	if (!scores.empty() && !overlap_ths.empty()){
+		std::vector<float> average_precisions;
+		float mean_ap = eval::AveragePrecisionSweep(positions, gt_positions, scores, overlap_ths, average_precisions);
+		if (!map_file.empty() && !util::SaveAveragePrecisions(map_file, overlap_ths, average_precisions, mean_ap)){
+			std::cerr << "Error: Fail to save average precisions in " << map_file << std::endl;
+		}
+		std::cout << std::endl;
+		for (int i = 0; i < overlap_ths.size(); i++){
+			std::cout << "Average Precision (overlap " << overlap_ths[i] << "): " << average_precisions[i] << std::endl;
+		}
+		std::cout << "Mean Average Precision: " << mean_ap;
+	}
+
+	// confidence interval of average precision
+	if (!scores.empty() && bootstrap > 0){
+		std::vector<float> average_precisions;
+		float mean_ap = eval::BootstrapAveragePrecision(binded_index, scores, overlap_score, gt_positions,
+			bootstrap, bootstrap_seed, average_precisions);
+		std::sort(average_precisions.begin(), average_precisions.end());
+		std::cout << std::endl << "Bootstrap Average Precision (" << bootstrap << " resamples): " << mean_ap
+			<< ", " << confidence * 100 << "% CI: [" << Percentile(average_precisions, (1 - confidence) / 2)
+			<< ", " << Percentile(average_precisions, (1 + confidence) / 2) << "]";
+	}
+	else if (bootstrap > 0){
+		std::cerr << "Error: --bootstrap needs a score file ('-s')." << std::endl;
+	}
+
+	if (!profile_file.empty()){
+		std::cout << std::endl;
+		util::SaveProfile(profile_file);
+	}
+
 	return 0;
 }
 
@@ -0,0 +1,115 @@
+#ifndef __PARALLEL__
+#define __PARALLEL__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace util{
+
+	//! Number of threads to use when num_threads is 0
+	inline int hardware_threads()
+	{
+		int n = std::thread::hardware_concurrency();
+		return n > 0 ? n : 1;
+	}
+
+	//! Call func(i) for every i in [begin, end) on num_threads threads
+	/*!
+	Indices are handed out in small chunks from a shared counter, so threads that
+	get light items take more of them. With num_threads <= 1 the loop runs serially
+	on the calling thread. func(i) must only write data owned by item i.
+	\param[in] num_threads number of threads (0: all hardware threads)
+	\param[in] chunk number of indices taken at once (0: chosen from the range)
+	*/
+	template <typename Func>
+	void parallel_for(int begin, int end, const Func& func, int num_threads, int chunk = 0)
+	{
+		if (num_threads == 0)
+			num_threads = hardware_threads();
+		num_threads = std::min(num_threads, end - begin);
+		if (num_threads <= 1){
+			for (int i = begin; i < end; i++)
+				func(i);
+			return;
+		}
+
+		if (chunk <= 0)
+			chunk = std::max(1, (end - begin) / (num_threads * 16));
+
+		std::atomic<int> next(begin);
+		auto worker = [&](){
+			while (true){
+				int i = next.fetch_add(chunk);
+				if (i >= end)
+					break;
+				int i_end = std::min(i + chunk, end);
+				for (; i < i_end; i++)
+					func(i);
+			}
+		};
+
+		std::vector<std::thread> threads;
+		for (int t = 1; t < num_threads; t++)
+			threads.push_back(std::thread(worker));
+		worker();
+		for (int t = 0; t < threads.size(); t++)
+			threads[t].join();
+	}
+
+
+	//! Blocking queue with a fixed capacity for producer/consumer pipelines
+	/*!
+	push() waits while the queue is full, so a fast producer cannot run ahead
+	of its consumers. pop() waits for an item and returns false once the queue
+	is closed and empty.
+	*/
+	template <typename T>
+	class BoundedQueue
+	{
+	public:
+		explicit BoundedQueue(int capacity) : capacity_(capacity > 0 ? capacity : 1), closed_(false){}
+
+		void push(T item)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			not_full_.wait(lock, [this](){ return (int)queue_.size() < capacity_; });
+			queue_.push_back(std::move(item));
+			not_empty_.notify_one();
+		}
+
+		bool pop(T& item)
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			not_empty_.wait(lock, [this](){ return !queue_.empty() || closed_; });
+			if (queue_.empty())
+				return false;
+			item = std::move(queue_.front());
+			queue_.pop_front();
+			not_full_.notify_one();
+			return true;
+		}
+
+		//! No more items will be pushed
+		void close()
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			closed_ = true;
+			not_empty_.notify_all();
+		}
+
+	private:
+		int capacity_;
+		bool closed_;
+		std::deque<T> queue_;
+		std::mutex mutex_;
+		std::condition_variable not_full_, not_empty_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef __TEXTWRITER__
+#define __TEXTWRITER__
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "parallel.hpp"
+
+namespace util{
+
+	//! Output buffer size of TextWriter, and sizes from which write_rows() formats blocks of rows in parallel
+	enum{ TEXT_BUFFER_SIZE = 1 << 20, TEXT_PARALLEL_MIN = 16384, TEXT_BLOCK_ROWS = 4096 };
+
+	//! Text output with a large buffer, in the same format as std::ostream
+	/*!
+	Numbers are formatted into the buffer without iostream, ints as decimal digits and
+	floats as "%g" (the default precision 6 of std::ostream), and the buffer is written
+	to the file in blocks of TEXT_BUFFER_SIZE bytes. Without a file, the text is kept
+	in memory (str()) and can be appended to another writer.
+	*/
+	class TextWriter
+	{
+	public:
+		TextWriter() : to_file_(false){}
+		explicit TextWriter(const std::string& filename) : to_file_(false){ open(filename); }
+		~TextWriter(){ close(); }
+
+		//! Write to filename (text mode, as std::ofstream)
+		bool open(const std::string& filename)
+		{
+			ofs_.open(filename.c_str());
+			to_file_ = ofs_.is_open();
+			buffer_.reserve(TEXT_BUFFER_SIZE + 64);
+			return to_file_;
+		}
+
+		bool is_open() const { return to_file_; }
+
+		//! Write the rest of the buffer and close the file
+		/*!
+		\return false if writing to the file failed
+		*/
+		bool close()
+		{
+			if (!to_file_)
+				return true;
+			flush();
+			ofs_.close();
+			to_file_ = false;
+			return !ofs_.fail();
+		}
+
+		void flush()
+		{
+			if (to_file_ && !buffer_.empty()){
+				ofs_.write(buffer_.data(), buffer_.size());
+				buffer_.clear();
+			}
+		}
+
+		//! Text not yet written to the file
+		const std::string& str() const { return buffer_; }
+		void clear(){ buffer_.clear(); }
+
+		void write(const char* data, size_t size)
+		{
+			buffer_.append(data, size);
+			if (to_file_ && buffer_.size() >= TEXT_BUFFER_SIZE)
+				flush();
+		}
+
+		TextWriter& operator<<(const TextWriter& text){ write(text.buffer_.data(), text.buffer_.size()); return *this; }
+		TextWriter& operator<<(const std::string& str){ write(str.data(), str.size()); return *this; }
+		TextWriter& operator<<(const char* str){ write(str, strlen(str)); return *this; }
+		TextWriter& operator<<(char c){ write(&c, 1); return *this; }
+
+		TextWriter& operator<<(int value)
+		{
+			char digits[16];
+			char* p = digits + sizeof(digits);
+			unsigned int u = value < 0 ? 0u - (unsigned int)value : (unsigned int)value;
+			do{
+				*--p = '0' + u % 10;
+				u /= 10;
+			} while (u > 0);
+			if (value < 0)
+				*--p = '-';
+			write(p, digits + sizeof(digits) - p);
+			return *this;
+		}
+
+		TextWriter& operator<<(double value)
+		{
+			char digits[32];
+			int length = sprintf(digits, "%g", value);
+			write(digits, length);
+			return *this;
+		}
+
+		TextWriter& operator<<(float value){ return *this << (double)value; }
+
+	private:
+		TextWriter(const TextWriter&);
+		TextWriter& operator=(const TextWriter&);
+
+		std::ofstream ofs_;
+		std::string buffer_;
+		bool to_file_;
+	};
+
+
+	//! Write rows 0 ... n - 1 in order with format(writer, i)
+	/*!
+	From TEXT_PARALLEL_MIN rows, blocks of TEXT_BLOCK_ROWS rows are formatted on
+	num_threads threads into memory and appended in order, so the output is the same
+	as a serial loop. format must only read shared data.
+	\param[in] num_threads number of threads (1: serial, 0: all hardware threads)
+	*/
+	template <typename Format>
+	void write_rows(TextWriter& writer, int n, const Format& format, int num_threads = 1)
+	{
+		if (num_threads == 0)
+			num_threads = hardware_threads();
+		if (num_threads <= 1 || n < TEXT_PARALLEL_MIN){
+			for (int i = 0; i < n; i++)
+				format(writer, i);
+			return;
+		}
+
+		int T = num_threads;
+		std::vector<TextWriter> blocks(T);
+		for (int begin = 0; begin < n; begin += T * TEXT_BLOCK_ROWS){
+			parallel_for(0, T, [&](int t){
+				blocks[t].clear();
+				int block_begin = std::min(begin + t * TEXT_BLOCK_ROWS, n);
+				int block_end = std::min(block_begin + TEXT_BLOCK_ROWS, n);
+				for (int i = block_begin; i < block_end; i++)
+					format(blocks[t], i);
+			}, T, 1);
+			for (int t = 0; t < T; t++)
+				writer << blocks[t];
+		}
+	}
+
+}
+
+#endif